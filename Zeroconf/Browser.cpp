@@ -0,0 +1,524 @@
+#include "Browser.h"
+
+#include <algorithm>
+#include <atomic>
+#include <future>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace zeroconf {
+
+//---------------------------------------------------------------------
+//--- Browser::Batch
+//---------------------------------------------------------------------
+
+// Collects the changes of one pollBatch(). Services are tracked by identity,
+// the backends keep the same ServicePtr for the lifetime of a service.
+
+class Browser::Batch
+{
+    enum Change { ADDED, UPDATED, REMOVED, CANCELLED };
+
+public:
+
+    void added(ServicePtr s)
+    {
+        auto* c = find(s);
+        if      (!c)               { insert(s, ADDED); }
+        else if (*c == REMOVED)    { *c = UPDATED;     }
+        else if (*c == CANCELLED)  { *c = ADDED;       }
+    }
+
+    void updated(ServicePtr s)
+    {
+        auto* c = find(s);
+        if      (!c)               { insert(s, UPDATED); }
+        else if (*c == CANCELLED)  { *c = ADDED;         }
+    }
+
+    void removed(ServicePtr s)
+    {
+        auto* c = find(s);
+        if      (!c)               { insert(s, REMOVED); }
+        else if (*c == ADDED)      { *c = CANCELLED;     }
+        else if (*c == UPDATED)    { *c = REMOVED;       }
+    }
+
+    ChangeSet changeSet() const
+    {
+        ChangeSet result;
+        for (const auto& e : _changes)
+        {
+            switch (e.second)
+            {
+                case ADDED:     { result.added.push_back(e.first);   break; }
+                case UPDATED:   { result.updated.push_back(e.first); break; }
+                case REMOVED:   { result.removed.push_back(e.first); break; }
+                case CANCELLED: { break; }
+            }
+        }
+        return result;
+    }
+
+private:
+
+    Change* find(const ServicePtr& s)
+    {
+        auto it = _index.find(s.get());
+        return it == _index.end() ? nullptr : &_changes[it->second].second;
+    }
+
+    void insert(ServicePtr s, Change c)
+    {
+        _index[s.get()] = _changes.size();
+        _changes.emplace_back(std::move(s), c);
+    }
+
+    std::vector<std::pair<ServicePtr, Change>> _changes;   // in order of first appearance
+    std::unordered_map<Service*, size_t>       _index;
+};
+
+//---------------------------------------------------------------------
+//--- Browser::Updates
+//---------------------------------------------------------------------
+
+// Filters serviceUpdated: drops updates which changed nothing and holds back
+// updates arriving within the update window after the last emitted one. Runs on
+// the backend thread in direct dispatch, so it has its own lock and never
+// emits itself.
+
+class Browser::Updates
+{
+    using Clock = std::chrono::steady_clock;
+
+    struct Entry
+    {
+        ServicePtr        service;
+        Service           emitted;    // state at the last emission
+        Clock::time_point time;
+        bool              pending = false;
+    };
+
+public:
+    Updates(const Options& options)
+    : _window(options.updateWindow)
+    , _dropUnchanged(options.dropUnchanged)
+    {}
+
+    bool enabled() const { return _window.count() > 0 || _dropUnchanged; }
+
+    void added(const ServicePtr& s)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto& e   = _entries[s.get()];
+        e.service = s;
+        e.emitted = *s;
+        e.time    = Clock::now();
+        e.pending = false;
+    }
+
+    void removed(const ServicePtr& s)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _entries.erase(s.get());
+        _pending.erase(std::remove(_pending.begin(), _pending.end(), s.get()), _pending.end());
+    }
+
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _entries.clear();
+        _pending.clear();
+    }
+
+    // Returns true if the update is to be emitted right away
+    bool updated(const ServicePtr& s)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        auto it = _entries.find(s.get());
+        if (it == _entries.end()) { return true; }
+
+        auto& e = it->second;
+        if (e.pending) { ++_coalesced; return false; }
+        if (_dropUnchanged && e.emitted == *s) { ++_unchanged; return false; }
+
+        auto now = Clock::now();
+        if (now - e.time < _window)
+        {
+            e.pending = true;
+            _pending.push_back(s.get());
+            return false;
+        }
+
+        e.emitted = *s;
+        e.time    = now;
+        return true;
+    }
+
+    // Held back updates whose window has passed
+    std::vector<ServicePtr> due()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        auto now    = Clock::now();
+        auto result = std::vector<ServicePtr>();
+        auto keep   = _pending.begin();
+        for (auto* p : _pending)
+        {
+            auto& e = _entries[p];
+            if (now - e.time < _window) { *keep++ = p; continue; }
+
+            e.pending = false;
+            if (_dropUnchanged && e.emitted == *e.service) { ++_unchanged; continue; }
+
+            e.emitted = *e.service;
+            e.time    = now;
+            result.push_back(e.service);
+        }
+        _pending.erase(keep, _pending.end());
+        return result;
+    }
+
+    // Time until the next held back update is due, limited to timeout
+    std::chrono::milliseconds next(std::chrono::milliseconds timeout)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        auto now = Clock::now();
+        for (auto* p : _pending)
+        {
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(_entries[p].time + _window - now);
+            timeout = std::max(std::chrono::milliseconds(0), std::min(timeout, left + std::chrono::milliseconds(1)));
+        }
+        return timeout;
+    }
+
+    size_t unchanged() const { return _unchanged; }
+    size_t coalesced() const { return _coalesced; }
+
+private:
+    const std::chrono::milliseconds _window;
+    const bool                      _dropUnchanged;
+
+    std::mutex                      _mutex;
+    std::unordered_map<const Service*, Entry> _entries;
+    std::vector<const Service*>     _pending;
+
+    std::atomic<size_t>             _unchanged = {0};
+    std::atomic<size_t>             _coalesced = {0};
+};
+
+//---------------------------------------------------------------------
+//--- Browser::Outbox
+//---------------------------------------------------------------------
+
+// Signals held back by poll(). Filled under the backend's lock and emitted
+// after it by the same poll(), which is serialized, so it has no lock of its
+// own.
+
+class Browser::Outbox
+{
+public:
+    enum Kind { ADDED, UPDATED, REMOVED, FAILED, SNAPSHOT_COMPLETE, TYPE_ADDED, TYPE_REMOVED, RESOLVED };
+
+    struct Held
+    {
+        Kind                     kind  = ADDED;
+        ServicePtr               service;
+        Error                    error = ZC_BROWSER_FAILED;
+        std::string              type;
+        std::promise<ServicePtr> promise;   // RESOLVED
+    };
+
+    // False if the signal is to be emitted right away
+    bool hold(Kind kind, ServicePtr s = nullptr, Error e = ZC_BROWSER_FAILED, const std::string& type = std::string())
+    {
+        if (!holding) { return false; }
+
+        held.emplace_back();
+        auto& h   = held.back();
+        h.kind    = kind;
+        h.service = std::move(s);
+        h.error   = e;
+        h.type    = type;
+        return true;
+    }
+
+    // A resolve() becomes ready after the serviceUpdated held before it
+    void fulfil(std::promise<ServicePtr>&& promise, ServicePtr result)
+    {
+        if (!holding) { promise.set_value(std::move(result)); return; }
+        held.emplace_back();
+        auto& h   = held.back();
+        h.kind    = RESOLVED;
+        h.service = std::move(result);
+        h.promise = std::move(promise);
+    }
+
+    bool              holding  = false;
+    bool              emitting = false;
+    std::vector<Held> held;
+};
+
+//---------------------------------------------------------------------
+//--- Browser::Lookups
+//---------------------------------------------------------------------
+
+// Pending resolve() calls by service identity. Used by the backends with their
+// state locked, so it has no lock of its own.
+
+class Browser::Lookups
+{
+    struct Request
+    {
+        std::promise<ServicePtr>       promise;
+        std::shared_future<ServicePtr> future;
+    };
+
+public:
+
+    static std::shared_future<ServicePtr> ready(ServicePtr s)
+    {
+        std::promise<ServicePtr> p;
+        p.set_value(std::move(s));
+        return p.get_future().share();
+    }
+
+    // Sets first if no resolve was requested for the service yet
+    std::shared_future<ServicePtr> add(const ServicePtr& s, bool& first)
+    {
+        auto it = _requests.find(s.get());
+        first   = it == _requests.end();
+        if (!first) { return it->second.future; }
+
+        auto& r  = _requests[s.get()];
+        r.future = r.promise.get_future().share();
+        return r.future;
+    }
+
+    bool pending(const Service* s) const { return _requests.count(s) != 0; }
+
+    void done(const Service* s, ServicePtr result, Outbox& outbox)
+    {
+        auto it = _requests.find(s);
+        if (it == _requests.end()) return;
+
+        outbox.fulfil(std::move(it->second.promise), std::move(result));
+        _requests.erase(it);
+    }
+
+    void clear(Outbox& outbox)
+    {
+        for (auto& r : _requests)
+            outbox.fulfil(std::move(r.second.promise), nullptr);
+        _requests.clear();
+    }
+
+private:
+    std::unordered_map<const Service*, Request> _requests;
+};
+
+//---------------------------------------------------------------------
+//--- Browser, backend independent part
+//---------------------------------------------------------------------
+
+constexpr const char* Browser::ALL_TYPES;
+
+void Browser::init(const Options& options)
+{
+    _updates = std::make_shared<Updates>(options);
+    _lookups = std::make_shared<Lookups>();
+    _outbox  = std::make_shared<Outbox>();
+}
+
+Browser::Statistics Browser::statistics() const
+{
+    auto s = queueStatistics();
+    s.unchangedUpdates = _updates->unchanged();
+    s.coalescedUpdates = _updates->coalesced();
+    return s;
+}
+
+//---------------------------------------------------------------------
+
+Browser::ChangeSet Browser::pollBatch()
+{
+    Batch batch;
+    pollBatch(batch);
+    return batch.changeSet();
+}
+
+//---------------------------------------------------------------------
+
+bool Browser::waitFor(const std::function<bool()>& predicate, std::chrono::milliseconds timeout)
+{
+    using Clock = std::chrono::steady_clock;
+
+    poll();
+    auto deadline = Clock::now() + timeout;
+    while (!predicate())
+    {
+        auto now = Clock::now();
+        if (now >= deadline) return false;
+
+        poll(std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now) + std::chrono::milliseconds(1));
+    }
+    return true;
+}
+
+//---------------------------------------------------------------------
+
+void Browser::notifyAdded(ServicePtr s)
+{
+    if (_updates->enabled()) _updates->added(s);
+
+    if      (_batch)                           { _batch->added(s);  }
+    else if (!_outbox->hold(Outbox::ADDED, s)) { _serviceAdded(s); }
+
+    _changed(ADDED, s);
+}
+
+void Browser::notifyUpdated(ServicePtr s)
+{
+    if (_updates->enabled() && !_updates->updated(s)) return;
+    emitUpdated(s);
+}
+
+void Browser::notifyRemoved(ServicePtr s)
+{
+    if (_updates->enabled()) _updates->removed(s);
+
+    if      (_batch)                             { _batch->removed(s);  }
+    else if (!_outbox->hold(Outbox::REMOVED, s)) { _serviceRemoved(s); }
+
+    _changed(REMOVED, s);
+    _lookups->done(s.get(), nullptr, *_outbox);
+}
+
+void Browser::notifyCleared()
+{
+    if (_updates->enabled()) _updates->clear();
+    _lookups->clear(*_outbox);
+
+    _changed(CLEARED, nullptr);
+}
+
+void Browser::notifyError(Error e)
+{
+    if (!_outbox->hold(Outbox::FAILED, nullptr, e)) _error(e);
+}
+
+void Browser::notifySnapshotComplete()
+{
+    if (!_outbox->hold(Outbox::SNAPSHOT_COMPLETE)) _snapshotComplete();
+}
+
+void Browser::notifyTypeAdded(const std::string& type)
+{
+    if (!_outbox->hold(Outbox::TYPE_ADDED, nullptr, ZC_BROWSER_FAILED, type)) _typeAdded(type);
+}
+
+void Browser::notifyTypeRemoved(const std::string& type)
+{
+    if (!_outbox->hold(Outbox::TYPE_REMOVED, nullptr, ZC_BROWSER_FAILED, type)) _typeRemoved(type);
+}
+
+//---------------------------------------------------------------------
+
+void Browser::holdSignals(bool hold)
+{
+    _outbox->holding = hold;
+}
+
+// A poll() from a handler leaves its signals to the one emitting, which keeps
+// them in order
+void Browser::emitHeld()
+{
+    auto& o = *_outbox;
+    if (o.emitting) return;
+
+    o.emitting = true;
+    for (size_t i = 0; i < o.held.size(); ++i)
+    {
+        auto h = std::move(o.held[i]);
+        switch (h.kind)
+        {
+            case Outbox::ADDED:             { _serviceAdded(h.service);   break; }
+            case Outbox::UPDATED:           { _serviceUpdated(h.service); break; }
+            case Outbox::REMOVED:           { _serviceRemoved(h.service); break; }
+            case Outbox::FAILED:            { _error(h.error);            break; }
+            case Outbox::SNAPSHOT_COMPLETE: { _snapshotComplete();        break; }
+            case Outbox::TYPE_ADDED:        { _typeAdded(h.type);         break; }
+            case Outbox::TYPE_REMOVED:      { _typeRemoved(h.type);       break; }
+            case Outbox::RESOLVED:          { h.promise.set_value(h.service); break; }
+        }
+    }
+    o.held.clear();
+    o.emitting = false;
+}
+
+//---------------------------------------------------------------------
+
+void Browser::emitUpdated(ServicePtr s)
+{
+    if      (_batch)                             { _batch->updated(s);  }
+    else if (!_outbox->hold(Outbox::UPDATED, s)) { _serviceUpdated(s); }
+
+    _changed(UPDATED, s);
+}
+
+void Browser::flushUpdates()
+{
+    if (!_updates->enabled()) return;
+
+    for (auto& s : _updates->due())
+        emitUpdated(s);
+}
+
+std::shared_future<ServicePtr> Browser::lookupReady(ServicePtr s)
+{
+    return Lookups::ready(std::move(s));
+}
+
+std::shared_future<ServicePtr> Browser::lookupRequest(const ServicePtr& s, bool& first)
+{
+    return _lookups->add(s, first);
+}
+
+bool Browser::lookupPending(const Service* s) const
+{
+    return _lookups->pending(s);
+}
+
+void Browser::lookupDone(const Service* s, ServicePtr result)
+{
+    _lookups->done(s, std::move(result), *_outbox);
+}
+
+//---------------------------------------------------------------------
+
+void Browser::setAddresses(Service& s, Protocol protocol, const std::vector<std::string>& addresses)
+{
+    auto& all = s.addresses;
+    all.erase(std::remove_if(all.begin(), all.end(), [=] (const Address& a) { return a.protocol == protocol; }), all.end());
+
+    for (const auto& a : addresses)
+        all.push_back({protocol, a});
+
+    std::stable_sort(all.begin(), all.end(), [] (const Address& a, const Address& b) { return a.protocol < b.protocol; });
+
+    s.protocol = all.empty() ? PROTOCOL_UNSPEC : all.front().protocol;
+    s.address  = all.empty() ? std::string() : all.front().address;
+}
+
+//---------------------------------------------------------------------
+
+std::chrono::milliseconds Browser::flushTimeout(std::chrono::milliseconds timeout) const
+{
+    return _updates->enabled() ? _updates->next(timeout) : timeout;
+}
+
+}
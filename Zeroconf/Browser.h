@@ -13,11 +13,15 @@
 //  You should have received a copy of the GNU General Public License
 //  along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #pragma once
+#include <Zeroconf/Context.h>
 #include <Zeroconf/Service.h>
+#include <Zeroconf/Signal.h>
 
-#include <boost/signals2.hpp>
+#include <chrono>
+#include <future>
 #include <memory>
 #include <string>
+#include <vector>
 
 
 namespace zeroconf {
@@ -26,30 +30,138 @@ namespace zeroconf {
 
 using ServicePtr = std::shared_ptr<Service>;
 
+class Subscriber;
+
 //---------------------------------------------------------------------
     
 class Browser
 {
-   using Connection = boost::signals2::connection; 
-
 public:
 
     enum Error 
     {
         ZC_BROWSER_FAILED = -1,
-        ZC_BROWSER_ALRADY_RUNNING = -2
+        ZC_BROWSER_ALRADY_RUNNING = -2,
+        ZC_BROWSER_EVENTS_LOST = -3         // the event queue dropped events since the last poll()
+    };
+
+    struct Statistics
+    {
+        size_t queued;              // events waiting for poll()
+        size_t dropped;             // events lost to the backpressure policy or because the queue couldn't grow
+        size_t coalesced;           // events replaced by a later one for the same service (BACKPRESSURE_COALESCE)
+        size_t highWater;           // largest number of events queued at once
+        size_t unchangedUpdates;    // serviceUpdated skipped because nothing changed
+        size_t coalescedUpdates;    // serviceUpdated merged into a later one by the update window
+        size_t resolvesInFlight;    // resolves the daemon is working on
+        size_t resolvesQueued;      // resolves waiting for a slot (see Options::maxResolves)
+        size_t resolvesTimedOut;    // resolves which got no answer in time
+        size_t monitored;           // services under continuous resolution (see Options::monitorServices)
+    };
+
+    // Meta-query type: browsing it enumerates the service types on the network
+    static constexpr const char* ALL_TYPES = "_services._dns-sd._udp";
+
+    struct ChangeSet
+    {
+        std::vector<ServicePtr> added;
+        std::vector<ServicePtr> updated;
+        std::vector<ServicePtr> removed;
+
+        bool empty() const { return added.empty() && updated.empty() && removed.empty(); }
+    };
+
+    struct Options
+    {
+        // Daemon connection to run on, nullptr shares Context::shared()
+        std::shared_ptr<Context>  context;
+
+        Dispatch                  dispatch      = DISPATCH_QUEUED;
+
+        // Bounds the event queue, 0 lets it grow as needed. backpressure decides
+        // what happens to events arriving while it is full.
+        size_t                    queueCapacity = 0;
+        Backpressure              backpressure  = BACKPRESSURE_DROP_NEWEST;
+
+        // Updates of a service within this window after its last serviceUpdated are
+        // held back and emitted once, with the final state, when the window ends
+        std::chrono::milliseconds updateWindow  = std::chrono::milliseconds(0);
+
+        // Skip serviceUpdated when none of the fields of the service changed
+        bool                      dropUnchanged = false;
+
+        // Caps the resolves in flight, 0 means no limit. Further resolves wait
+        // in a backlog, ordered by resolvePriority (higher first) if given and
+        // by arrival otherwise. The service passed to it is not resolved yet.
+        size_t                    maxResolves   = 0;
+        std::function<int(const Service&)> resolvePriority;
+
+        // Report services as soon as they are browsed, with name, type, domain,
+        // interface and protocol only, and resolve them on request (see resolve())
+        bool                      resolveOnDemand = false;
+
+        // Keep resolving up to this many services after their first resolve, so
+        // changes of address, port or host are emitted with serviceUpdated. 0
+        // resolves once. Beyond the cap the service whose last change or
+        // resolve() lies furthest back is demoted to a one-shot resolve.
+        size_t                    monitorServices = 0;
     };
 
 	Browser();
+	explicit Browser(const Options& options);
 	~Browser();
 
-    // Run processing loop
+    // Run processing loop. The handlers run once the backend is unlocked again,
+    // a slow one doesn't hold up the other Browsers and Publishers of the context.
     void poll();
 
-    // Start/Stop Browsing for Services
-	void start(const std::string& type);
+    // Blocks up to timeout until the backend delivers events, then processes them
+    void poll(std::chrono::milliseconds timeout);
+
+    // Held back updates (see Options::updateWindow) are emitted from poll() and
+    // pollBatch(), also in direct dispatch.
+
+    // Processes all queued events like poll(), but returns the changes as one set
+    // instead of emitting serviceAdded/Updated/Removed per event. Services added
+    // and removed within the same drain are left out, repeated updates merged.
+    ChangeSet pollBatch();
+
+    // Polls until predicate returns true or timeout expires, returns the last result of predicate
+    bool waitFor(const std::function<bool()>& predicate, std::chrono::milliseconds timeout);
+
+    // Resolves a service reported by Options::resolveOnDemand. The service is
+    // filled in place and emitted with serviceUpdated, then the future becomes
+    // ready with it, or with nullptr if it couldn't be resolved or went away.
+    // That happens in poll(), or on the backend thread in direct dispatch, so
+    // don't wait for it on the polling thread. Resolved services are returned
+    // right away, concurrent requests for one service share one resolve.
+    std::shared_future<ServicePtr> resolve(ServicePtr service);
+
+    // Currently known services
+    std::vector<ServicePtr> services() const;
+
+    // Event queue counters, safe to call from any thread
+    Statistics statistics() const;
+
+    // File descriptor which becomes readable when poll() has work to do.
+    // Register it with epoll/select instead of calling poll() on a timer.
+    int nativeHandle() const;
+
+    // Start/Stop Browsing for Services. PROTOCOL_UNSPEC browses IPv4 and IPv6,
+    // an instance seen on both is reported once with the addresses of both.
+	void start(const std::string& type, Protocol protocol = PROTOCOL_IPv4);
 	void stop();
 
+    // Browse further types at runtime, with the protocol given to start(). The
+    // services of all types share one registry and one poll(). Removing a type
+    // removes its services. Adding ALL_TYPES browses every type announced on the
+    // network, reported with typeAdded/Removed and browsed until it goes away.
+    void addType(const std::string& type);
+    void removeType(const std::string& type);
+
+    // Types browsed, ALL_TYPES and those it found included
+    std::vector<std::string> types() const;
+
     // Callbacks
 	Connection connectServiceAdded(const std::function<void(ServicePtr)> handler)
     { return _serviceAdded.connect(handler); }
@@ -63,15 +175,90 @@ public:
 	Connection connectError(const std::function<void(Error)> handler)
     { return _error.connect(handler); }
 
+	Connection connectTypeAdded(const std::function<void(std::string)> handler)
+    { return _typeAdded.connect(handler); }
+
+	Connection connectTypeRemoved(const std::function<void(std::string)> handler)
+    { return _typeRemoved.connect(handler); }
+
+    // Emitted once per start(), when the daemon has reported every instance it
+    // knows of all types browsed so far and all of them are resolved (only those
+    // asked for by resolve() with Options::resolveOnDemand). Later arrivals come
+    // as usual. mDNSResponder doesn't reply for a type without instances, with
+    // Bonjour a type which got no reply within a second counts as complete.
+	Connection connectSnapshotComplete(const std::function<void()> handler)
+    { return _snapshotComplete.connect(handler); }
+
 private:
 
+    friend Subscriber;
+
+    // Feeds the subscribers with every change the signals see, in pollBatch() too
+    enum Change { ADDED, UPDATED, REMOVED, CLEARED };
+    using ChangeHandler = std::function<void(Change, ServicePtr)>;
+
+    // Connects handler and passes it the known services as ADDED, atomically
+    // with respect to the backend
+    Connection subscribe(const ChangeHandler& handler);
+
+    class Updates;
+    std::shared_ptr<Updates> _updates;
+
+    class Lookups;
+    std::shared_ptr<Lookups> _lookups;
+
+    // Bookkeeping of resolve(), for the backends
+    static std::shared_future<ServicePtr> lookupReady(ServicePtr s);
+    std::shared_future<ServicePtr> lookupRequest(const ServicePtr& s, bool& first);
+    bool lookupPending(const Service* s) const;
+    void lookupDone(const Service* s, ServicePtr result);
+
 	class Impl; friend Impl;
-    std::unique_ptr<Impl> _impl;
+
+    void init(const Options& options);
+    Statistics queueStatistics() const;
+
+    // Called by the backend, either emit the signals or collect into a pollBatch()
+    void notifyAdded(ServicePtr s);
+    void notifyUpdated(ServicePtr s);
+    void notifyRemoved(ServicePtr s);
+    void notifyCleared();
+    void notifyError(Error e);
+    void notifySnapshotComplete();
+    void notifyTypeAdded(const std::string& type);
+    void notifyTypeRemoved(const std::string& type);
+
+    // poll() holds the signals back while it has the backend locked and emits
+    // them once it released it, a slow handler doesn't stall the backend thread.
+    // _changed stays under the lock, subscribe() relies on it.
+    class Outbox;
+    std::shared_ptr<Outbox> _outbox;
+    void holdSignals(bool hold);    // under the backend's lock
+    void emitHeld();
+
+    // Replaces the addresses of one protocol and updates the primary address
+    static void setAddresses(Service& s, Protocol protocol, const std::vector<std::string>& addresses);
+
+    void emitUpdated(ServicePtr s);
+    void flushUpdates();
+    std::chrono::milliseconds flushTimeout(std::chrono::milliseconds timeout) const;
+
+    // poll() collecting into a batch, by the backend
+    class Batch;
+    void pollBatch(Batch& batch);
+    Batch* _batch = nullptr;    // set and read under the backend's lock
     
-	boost::signals2::signal<void(ServicePtr)>	_serviceAdded;
-	boost::signals2::signal<void(ServicePtr)>	_serviceUpdated;
-	boost::signals2::signal<void(ServicePtr)>	_serviceRemoved;
-	boost::signals2::signal<void(Error)>	    _error;
+	Signal<ServicePtr>	_serviceAdded;
+	Signal<ServicePtr>	_serviceUpdated;
+	Signal<ServicePtr>	_serviceRemoved;
+	Signal<Error>	    _error;
+	Signal<>	        _snapshotComplete;
+	Signal<std::string>	_typeAdded;
+	Signal<std::string>	_typeRemoved;
+    Signal<Change, ServicePtr> _changed;
+
+    // Last, the backend emits signals until it is gone
+    std::unique_ptr<Impl> _impl;
 };
 
 }
@@ -1,216 +1,1164 @@
 #include "Browser.h"
 
-#include <avahi-client/client.h>
 #include <avahi-common/error.h>
-#include <avahi-common/thread-watch.h>
-#include <avahi-client/lookup.h>
 
-#include <boost/lockfree/spsc_queue.hpp>
+#include "Context_avahiclient.h"
+#include "EventQueue.h"
+#include "MonitorList.h"
+#include "ResolveBacklog.h"
 
-#include <iostream>
+#include <atomic>
+#include <cstring>
 #include <map>
+#include <mutex>
+#include <set>
+#include <vector>
 
 namespace zeroconf {
 
 //---------------------------------------------------------------------
 
+namespace
+{
+
+    size_t length(const char* s) { return s ? std::strlen(s) : 0; }
+
+    AvahiProtocol toAvahi(Protocol p)
+    {
+        switch (p)
+        {
+            case PROTOCOL_IPv4:   { return AVAHI_PROTO_INET;   }
+            case PROTOCOL_IPv6:   { return AVAHI_PROTO_INET6;  }
+            case PROTOCOL_UNSPEC: { return AVAHI_PROTO_UNSPEC; }
+        }
+        return AVAHI_PROTO_UNSPEC;
+    }
+
+    Protocol fromAvahi(AvahiProtocol p)
+    {
+        if (p == AVAHI_PROTO_INET6) return PROTOCOL_IPv6;
+        if (p == AVAHI_PROTO_INET)  return PROTOCOL_IPv4;
+        return PROTOCOL_UNSPEC;
+    }
+
+    // Bit of a protocol in Browser::Impl::Sightings
+    unsigned bit(AvahiProtocol p) { return p == AVAHI_PROTO_INET6 ? 2u : 1u; }
+}
+
+//---------------------------------------------------------------------
+
 class Browser::Impl
 {
     using ServiceMap         = std::map<std::string, ServicePtr>;
-    using AvahiPollPtr       = std::unique_ptr<AvahiThreadedPoll,   decltype(&avahi_threaded_poll_free)>;
-    using AvahiClientPtr     = std::unique_ptr<::AvahiClient,       decltype(&avahi_client_free)>;
-    using AvahiBrowserPtr    = std::unique_ptr<AvahiServiceBrowser, decltype(&avahi_service_browser_free)>;
+    using Sightings          = std::map<std::string, unsigned>;
+    using Resolvers          = std::map<std::string, avahi::ServiceResolver*>;
+    using AvahiBrowserPtr    = avahi::Ptr<avahi::ServiceBrowser>;
+    using AvahiTypeBrowserPtr = avahi::Ptr<avahi::TypeBrowser>;
+
+    // The browse of one service type
+    struct Browse
+    {
+        AvahiBrowserPtr browser    = {nullptr, &avahi::destroy};
+        bool            discovered = false;     // added by the ALL_TYPES browse
+        bool            allForNow  = false;     // ALL_FOR_NOW seen
+    };
+    using Browses            = std::map<std::string, Browse>;
+
+    // Browse and resolve results handed from the avahi thread to poll()
+    struct Event
+    {
+        enum Kind { BROWSE_NEW, BROWSE_REMOVE, BROWSE_ALL_FOR_NOW, BROWSE_FAILURE, TYPE_NEW, TYPE_REMOVE,
+                    RESOLVE_FOUND, RESOLVE_FAILURE };
 
-    using QueueEvent = std::function<void()>;
-    using Queue      = boost::lockfree::spsc_queue<QueueEvent>;
+        Kind                  kind      = BROWSE_FAILURE;
+        avahi::Id             source    = 0;  // service or type browser, browse events only
+        AvahiIfIndex          interface = AVAHI_IF_UNSPEC;
+        AvahiProtocol         protocol  = AVAHI_PROTO_UNSPEC;
+        avahi::Id             resolver  = 0;
+        int                   error     = AVAHI_OK;
+        AvahiAddress          address   = {};
+        uint16_t              port      = 0;
+        Text                  name;
+        Text                  type;
+        Text                  domain;
+        Text                  host;
+        Text                  txt;      // wire format
+    };
+
+    using Queue = EventQueue<Event>;
 
 public:
-	Impl(Browser* parent);
+	Impl(Browser* parent, const Options& options);
 	~Impl();
 	
-    void poll();
-	void start(const std::string& type);
+    void poll(Batch* batch = nullptr);
+    void poll(std::chrono::milliseconds timeout);
+    std::vector<ServicePtr> services() const;
+    Statistics statistics() const;
+    int nativeHandle() const { return _queue.nativeHandle(); }
+    Connection subscribe(const ChangeHandler& handler);
+    std::shared_future<ServicePtr> request(ServicePtr service);
+	void start(const std::string& type, Protocol protocol);
 	void stop();
+    void addType(const std::string& type);
+    void removeType(const std::string& type);
+    std::vector<std::string> types() const;
 
 private:
 
-    void error(Error e)                 { _parent->_error(e);           }
-    void serviceAdded(ServicePtr s)     { _parent->_serviceAdded(s);    }
-    void serviceUpdated(ServicePtr s)   { _parent->_serviceUpdated(s);  }
-    void serviceRemoved(ServicePtr s)   { _parent->_serviceRemoved(s);  }
+    // Instances are told apart by type, name and interface
+    static std::string serviceKey(const std::string& name, const std::string& type, AvahiIfIndex interface)
+    { return type + '\0' + name + '\0' + std::to_string((int)interface); }
+    static std::string resolveKey(const std::string& serviceKey, AvahiProtocol protocol) { return serviceKey + '/' + std::to_string(protocol); }
+
+    Context::Impl& context() const      { return *_context->_impl;      }
+    void error(Error e)                 { _parent->notifyError(e);      }
+    void serviceAdded(ServicePtr s)     { _parent->notifyAdded(s);      }
+    void serviceUpdated(ServicePtr s)   { _parent->notifyUpdated(s);    }
+    void serviceRemoved(ServicePtr s)   { _parent->notifyRemoved(s);    }
+
+    template <typename F>
+    bool dispatch(size_t bytes, F&& build);
+    void process(const Event& e);
+    static std::string key(const Event& e);
+    static bool keep(const Event& e);
+
+    void onBrowseCallback(const Event& e);
+    void onTypeCallback(const Event& e);
+    Browses::iterator findBrowse(avahi::Id source);
+    void addType(const std::string& type, bool discovered);
+    bool startBrowse(const std::string& type, Browse& browse);
+    bool startTypeBrowse();
+    void dropType(const std::string& type);
+    void drop(const std::string& serviceKey);
+
+    void onStateChanged();
+    void sync();
+    void attach(const Context::Impl::ClientPtr& client);
+    void detach();
+    void finishResync();
+    void onResolveCallback(const Event& e);
+    void onMonitorCallback(const Event& e, const std::string& serviceKey);
+    bool apply(const Event& e, Service& s) const;
 
-    void onBrowseCallback(AvahiIfIndex, AvahiProtocol, AvahiBrowserEvent,
-                          std::string name, std::string type, std::string domain);
+    void resolve(const std::string& key, const Service& service);
+    void startResolve(const std::string& key, const Service& service);
+    void cancelResolve(const std::string& key);
+    bool resolving(const std::string& serviceKey) const;
+    void resolveNext();
+    void resolvesChanged();
+    void checkSnapshot();
+    void monitor(const std::string& serviceKey);
+    void unmonitor(const std::string& serviceKey);
 
-    void onResolveCallback(AvahiIfIndex, Protocol, AvahiResolverEvent, 
-                           std::string name, std::string type, std::string domain, std::string host_name, 
-                           std::string address, uint16_t port);
+    // Declared first, the avahi objects below are freed before it
+    std::shared_ptr<Context> _context;
 
-    AvahiPollPtr    _poll       = {nullptr, &avahi_threaded_poll_free};
-    AvahiClientPtr  _client     = {nullptr, &avahi_client_free};
-	AvahiBrowserPtr _browser    = {nullptr, &avahi_service_browser_free};
+    // The client our avahi objects live on, nullptr while detached. Changes
+    // of the context client are picked up by sync().
+    Context::Impl::ClientPtr _client;
+    ScopedConnection    _stateConnection;
+    std::atomic<bool>   _syncPending = {false};
+
+    // Browses by type, and the ALL_TYPES browse with the number of
+    // interface/protocol pairs each type it found is seen on. While detached
+    // the browses are kept without their avahi browser.
+    Browses             _browses;
+    AvahiTypeBrowserPtr _typeBrowser = {nullptr, &avahi::destroy};
+    std::map<std::string, unsigned> _typeSightings;
+    bool                _allTypes     = false;
+    bool                _typesBrowsed = false;
+
+    // After a restart of the daemon: instances and types known before which
+    // weren't seen again yet, and the instances which were. What is still
+    // stale when the browses are complete again is removed.
+    std::set<std::string> _stale;
+    std::set<std::string> _recovered;
+    std::set<std::string> _staleTypes;
+    bool                _resyncing = false;
+
+    bool                _running  = false;
+    AvahiProtocol       _protocol = AVAHI_PROTO_INET;
 
 	Browser*	    _parent  = nullptr;
+    Dispatch        _dispatch;
     Queue           _queue;
+    std::vector<Event> _taken;      // reused by poll()
+    size_t          _lost = 0;      // drops already reported by poll()
 	ServiceMap      _services;
 
+    // Protocols each instance is currently seen on. An instance is resolved
+    // once per protocol and removed when it has vanished from all of them.
+    Sightings       _sightings;
+
+    // Resolvers in flight by instance and protocol, and the resolves waiting
+    // for one of the maxResolves slots
+    Resolvers       _resolvers;
+    ResolveBacklog  _backlog;
+    const size_t    _maxResolves;
+    const bool      _resolveOnDemand;
+
+    // Resolvers kept running after their first result, by instance and
+    // protocol, and the instances they belong to in order of use
+    Resolvers       _watchers;
+    MonitorList     _monitored;
+
+    // Whether snapshotComplete was emitted since start()
+    bool            _snapshotDone    = false;
+
+    std::atomic<size_t> _resolvesInFlight = {0};
+    std::atomic<size_t> _resolvesQueued   = {0};
+    std::atomic<size_t> _resolvesTimedOut = {0};
+    std::atomic<size_t> _monitoredCount   = {0};
+
+    // Guards the browser state against the avahi thread in direct dispatch.
+    // Always taken after the poll lock.
+    mutable std::recursive_mutex _mutex;
+
+    // Serializes poll(), taken before the poll lock
+    std::recursive_mutex _pollMutex;
+
 
     // --- AVAHI Callback functions
 
-	static void browseCallback(AvahiServiceBrowser*, AvahiIfIndex, AvahiProtocol, AvahiBrowserEvent, 
+	static void browseCallback(avahi::ServiceBrowser*, AvahiIfIndex, AvahiProtocol, AvahiBrowserEvent, 
             const char *name, const char *type, const char *domain, AvahiLookupResultFlags, void* userdata);
 
-	static void resolveCallback(AvahiServiceResolver*, AvahiIfIndex, AvahiProtocol, AvahiResolverEvent, 
+	static void typeCallback(avahi::TypeBrowser*, AvahiIfIndex, AvahiProtocol, AvahiBrowserEvent,
+            const char *type, const char *domain, AvahiLookupResultFlags, void* userdata);
+
+	static void resolveCallback(avahi::ServiceResolver*, AvahiIfIndex, AvahiProtocol, AvahiResolverEvent, 
             const char *name, const char *type, const char *domain, const char *host_name,  const AvahiAddress*, 
             uint16_t port, AvahiStringList*, AvahiLookupResultFlags, void* userdata);
 };
 
 //------------------------------------------------------------------------------
 
-Browser::Impl::Impl(Browser *parent)
-: _parent(parent)
-, _queue(20)
+Browser::Impl::Impl(Browser *parent, const Options& options)
+: _context(options.context ? options.context : Context::shared())
+, _parent(parent)
+, _dispatch(options.dispatch)
+, _queue(options.queueCapacity, options.backpressure, &Impl::key, &Impl::keep)
+, _backlog(options.resolvePriority)
+, _maxResolves(options.maxResolves)
+, _resolveOnDemand(options.resolveOnDemand)
+, _monitored(options.monitorServices)
 {
-    _poll.reset(avahi_threaded_poll_new());
-    if (!_poll) { std::cout << "Browser: Failed to create poll" << std::endl; return; }
-
-    int ret = 0;
-    _client.reset(avahi_client_new(avahi_threaded_poll_get(_poll.get()), {}, nullptr, this, &ret));
-    if (!_client) { std::cout << "Browser: Start avahi failed with error: " << avahi_strerror(ret) << std::endl; return; }
+    avahi::PollLock lock(context().poll());
+    _stateConnection = context().connectStateChanged([this] { onStateChanged(); });
 }
 
+// Freeing our avahi objects under the poll lock ends their callbacks, the
+// poll thread goes on serving the other users of the context
 Browser::Impl::~Impl()
 {
+    avahi::PollLock lock(context().poll());
+    _stateConnection.disconnect();
     stop();
+    _client.reset();
 }
 
 //---------------------------------------------------------------------
 
-void Browser::Impl::poll()
+// Handlers run once the locks are released and may call start() or stop().
+// The batch is set under the lock of direct dispatch, which collects into it
+// meanwhile.
+void Browser::Impl::poll(Batch* batch)
+{
+    // Taken out before the poll lock, which the avahi thread holds while
+    // it waits for room under BACKPRESSURE_BLOCK
+    std::lock_guard<std::recursive_mutex> polling(_pollMutex);
+    auto events = std::vector<Event>();
+    events.swap(_taken);
+    _queue.take(events);
+
+    {
+        avahi::PollLock lock(context().poll());
+        std::lock_guard<std::recursive_mutex> guard(_mutex);
+        _parent->_batch = batch;
+        _parent->holdSignals(true);
+
+        for (const auto& e : events) process(e);
+        _queue.taken();
+        events.clear();
+        _taken.swap(events);
+
+        // The events of the old client are through, follow the new one
+        if (_syncPending.exchange(false))
+            sync();
+
+        _parent->flushUpdates();
+
+        auto dropped = _queue.dropped();
+        if (dropped != _lost) { _lost = dropped; error(ZC_BROWSER_EVENTS_LOST); }
+
+        _parent->_batch = nullptr;
+        _parent->holdSignals(false);
+    }
+    _parent->emitHeld();
+}
+
+void Browser::Impl::poll(std::chrono::milliseconds timeout)
+{
+    _queue.wait(timeout);
+    poll();
+}
+
+std::vector<ServicePtr> Browser::Impl::services() const
+{
+    std::lock_guard<std::recursive_mutex> lock(_mutex);
+
+    auto result = std::vector<ServicePtr>();
+    result.reserve(_services.size());
+    for (const auto& s : _services)
+        result.push_back(s.second);
+    return result;
+}
+
+Browser::Statistics Browser::Impl::statistics() const
+{
+    auto s = Statistics();
+    s.queued    = _queue.size();
+    s.dropped   = _queue.dropped();
+    s.coalesced = _queue.coalesced();
+    s.highWater = _queue.highWater();
+    s.resolvesInFlight = _resolvesInFlight;
+    s.resolvesQueued   = _resolvesQueued;
+    s.resolvesTimedOut = _resolvesTimedOut;
+    s.monitored        = _monitoredCount;
+    return s;
+}
+
+Connection Browser::Impl::subscribe(const ChangeHandler& handler)
 {
-    _queue.consume_all([] (const auto& e) { e(); });
+    std::lock_guard<std::recursive_mutex> lock(_mutex);
+
+    for (const auto& s : _services)
+        handler(ADDED, s.second);
+    return _parent->_changed.connect(handler);
+}
+
+std::shared_future<ServicePtr> Browser::Impl::request(ServicePtr s)
+{
+    avahi::PollLock lock(context().poll());
+    std::lock_guard<std::recursive_mutex> guard(_mutex);
+
+    auto k  = serviceKey(s->name, s->type, s->interface);
+    auto it = _services.find(k);
+    if (it == _services.end() || it->second != s) { return lookupReady(nullptr); }
+    if (!s->host.empty())
+    {
+        if (_monitored.contains(k)) monitor(k);
+        return lookupReady(s);
+    }
+
+    auto first  = false;
+    auto result = _parent->lookupRequest(s, first);
+    if (!first) { return result; }
+
+    auto seen = _sightings[k];
+    for (auto p : {AVAHI_PROTO_INET, AVAHI_PROTO_INET6})
+    {
+        if (!(seen & bit(p))) continue;
+
+        auto service     = *s;
+        service.protocol = fromAvahi(p);
+        resolve(resolveKey(k, p), service);
+    }
+    return result;
 }
 
 //------------------------------------------------------------------------------
 
-void Browser::Impl::start(const std::string& type)
+void Browser::Impl::start(const std::string& type, Protocol protocol)
+{
+	if (_running) { error(ZC_BROWSER_ALRADY_RUNNING); return; }
+
+    {
+        std::lock_guard<std::recursive_mutex> guard(_mutex);
+        _protocol     = toAvahi(protocol);
+        _snapshotDone = false;
+    }
+    addType(type);
+}
+
+// A type added while the daemon isn't reachable is browsed once it is
+void Browser::Impl::addType(const std::string& type)
+{
+    avahi::PollLock lock(context().poll());
+    std::lock_guard<std::recursive_mutex> guard(_mutex);
+    sync();
+    addType(type, false);
+}
+
+// Types found by ALL_TYPES are browsed until they go away, unless they were
+// also added by hand
+void Browser::Impl::addType(const std::string& type, bool discovered)
+{
+    avahi::PollLock lock(context().poll());
+    _running = true;
+
+    if (type == ALL_TYPES)
+    {
+        if (_allTypes) return;
+
+        _allTypes = true;
+        if (!startTypeBrowse()) { _allTypes = false; error(ZC_BROWSER_FAILED); }
+        return;
+    }
+
+    auto it = _browses.find(type);
+    if (it != _browses.end()) { it->second.discovered &= discovered; return; }
+
+    auto& browse      = _browses[type];
+    browse.discovered = discovered;
+    if (!startBrowse(type, browse)) { _browses.erase(type); error(ZC_BROWSER_FAILED); }
+}
+
+// The browser is registered before the poll lock is given up, its first
+// events can't miss it. Returns false if avahi refused, true if created or
+// left for attach().
+bool Browser::Impl::startBrowse(const std::string& type, Browse& browse)
+{
+    browse.allForNow = false;
+    if (!_client) return true;
+
+    avahi::PollLock lock(context().poll());
+    browse.browser.reset(avahi::newServiceBrowser(_client.get(), AVAHI_IF_UNSPEC, _protocol, type.c_str(), NULL,
+                                                  AVAHI_LOOKUP_USE_MULTICAST, Browser::Impl::browseCallback, this));
+    return browse.browser != nullptr;
+}
+
+bool Browser::Impl::startTypeBrowse()
+{
+    _typesBrowsed = false;
+    if (!_client) return true;
+
+    avahi::PollLock lock(context().poll());
+    _typeBrowser.reset(avahi::newTypeBrowser(_client.get(), AVAHI_IF_UNSPEC, _protocol, NULL,
+                                             AVAHI_LOOKUP_USE_MULTICAST, Browser::Impl::typeCallback, this));
+    return _typeBrowser != nullptr;
+}
+
+void Browser::Impl::removeType(const std::string& type)
+{
+    avahi::PollLock lock(context().poll());
+    std::lock_guard<std::recursive_mutex> guard(_mutex);
+    dropType(type);
+}
+
+void Browser::Impl::dropType(const std::string& type)
+{
+    avahi::PollLock lock(context().poll());
+
+    if (type == ALL_TYPES)
+    {
+        _allTypes = false;
+        _typeBrowser.reset(nullptr);
+        _typeSightings.clear();
+        _staleTypes.clear();
+        for (auto it = _browses.begin(); it != _browses.end(); )
+        {
+            auto next = std::next(it);
+            if (it->second.discovered) dropType(it->first);
+            it = next;
+        }
+        checkSnapshot();
+        return;
+    }
+
+    auto it = _browses.find(type);
+    if (it == _browses.end()) return;
+
+    // Instances are keyed by type first. Built before the erase, type may
+    // be the key of the browse.
+    auto prefix = type + '\0';
+    _browses.erase(it);
+
+    for (auto s = _sightings.lower_bound(prefix); s != _sightings.end() && s->first.compare(0, prefix.size(), prefix) == 0; )
+        drop((s++)->first);
+
+    checkSnapshot();
+}
+
+std::vector<std::string> Browser::Impl::types() const
+{
+    std::lock_guard<std::recursive_mutex> lock(_mutex);
+
+    auto result = std::vector<std::string>();
+    if (_allTypes) result.push_back(ALL_TYPES);
+    for (const auto& b : _browses)
+        result.push_back(b.first);
+    return result;
+}
+
+// Forgets an instance and its resolves, emits serviceRemoved if it was reported
+void Browser::Impl::drop(const std::string& serviceKey)
 {
-	if (_browser) { error(ZC_BROWSER_ALRADY_RUNNING); return; }
+    for (auto p : {AVAHI_PROTO_INET, AVAHI_PROTO_INET6})
+        cancelResolve(resolveKey(serviceKey, p));
+    unmonitor(serviceKey);
+    _sightings.erase(serviceKey);
 
-	_browser.reset(avahi_service_browser_new(_client.get(), AVAHI_IF_UNSPEC, AVAHI_PROTO_INET, type.c_str(), NULL, 
-                                         AVAHI_LOOKUP_USE_MULTICAST, Browser::Impl::browseCallback, this));
-	if (!_browser)
-        error(ZC_BROWSER_FAILED);
+    auto it = _services.find(serviceKey);
+    if (it == _services.end()) return;
+
+    auto service = it->second;
+    _services.erase(it);
+    serviceRemoved(service);
 }
 
 //---------------------------------------------------------------------
 
 void Browser::Impl::stop()
 {
+    avahi::PollLock lock(context().poll());
+    std::lock_guard<std::recursive_mutex> guard(_mutex);
+
+    _running = false;
+    for (auto& r : _resolvers)
+        avahi::destroy(r.second);
+    _resolvers.clear();
+    _backlog.clear();
+    resolvesChanged();
+
+    for (auto& w : _watchers)
+        avahi::destroy(w.second);
+    _watchers.clear();
+    _monitored.clear();
+    _monitoredCount = 0;
+
     _services.clear();
-    _browser.reset(nullptr);
+    _sightings.clear();
+    _parent->notifyCleared();
+    _browses.clear();
+    _allTypes = false;
+    _typeBrowser.reset(nullptr);
+    _typeSightings.clear();
+    _stale.clear();
+    _recovered.clear();
+    _staleTypes.clear();
+}
+
+//---------------------------------------------------------------------
+
+// Called on the poll thread with the poll lock held. Direct dispatch follows
+// the client right away, queued dispatch with the next poll().
+void Browser::Impl::onStateChanged()
+{
+    if (_dispatch == DISPATCH_DIRECT)
+    {
+        std::lock_guard<std::recursive_mutex> lock(_mutex);
+        sync();
+        return;
+    }
+    _syncPending = true;
+    _queue.wake();
+}
+
+// Moves our avahi objects to the current client of the context
+void Browser::Impl::sync()
+{
+    avahi::PollLock lock(context().poll());
+
+    auto client = context().client();
+    if (_client && _client != client) detach();
+    if (!_client && client) attach(client);
+}
+
+// Browses again what was browsed before. After a restart of the daemon the
+// instances known so far stay until the browses are complete again, only
+// the differences are emitted then.
+void Browser::Impl::attach(const Context::Impl::ClientPtr& client)
+{
+    _client = client;
+
+    if (_allTypes && !startTypeBrowse()) { dropType(ALL_TYPES); error(ZC_BROWSER_FAILED); }
+
+    auto failed = std::vector<std::string>();
+    for (auto& b : _browses)
+        if (!startBrowse(b.first, b.second)) failed.push_back(b.first);
+    for (const auto& type : failed)
+        dropType(type);
+    if (!failed.empty()) error(ZC_BROWSER_FAILED);
+
+    checkSnapshot();
+}
+
+// The daemon went away: the objects of its client are freed, the instances
+// and types found so far are kept as stale
+void Browser::Impl::detach()
+{
+    for (auto& r : _resolvers)
+        avahi::destroy(r.second);
+    _resolvers.clear();
+    _backlog.clear();
+
+    for (auto& w : _watchers)
+        avahi::destroy(w.second);
+    _watchers.clear();
+
+    for (auto& b : _browses)
+        b.second.browser.reset(nullptr);
+    _typeBrowser.reset(nullptr);
+
+    _recovered.clear();
+    for (const auto& s : _services)
+        _stale.insert(s.first);
+    for (const auto& b : _browses)
+        if (b.second.discovered) _staleTypes.insert(b.first);
+    _sightings.clear();
+    _typeSightings.clear();
+
+    _client.reset();
+    resolvesChanged();
+}
+
+// Removes what didn't come back after a restart of the daemon
+void Browser::Impl::finishResync()
+{
+    auto stale      = std::set<std::string>();
+    auto staleTypes = std::set<std::string>();
+    stale.swap(_stale);
+    staleTypes.swap(_staleTypes);
+    _recovered.clear();
+
+    _resyncing = true;
+    for (const auto& type : staleTypes)
+    {
+        auto browse = _browses.find(type);
+        if (browse != _browses.end() && browse->second.discovered)
+            dropType(type);
+        _parent->notifyTypeRemoved(type);
+    }
+    for (const auto& k : stale)
+        drop(k);
+    _resyncing = false;
+}
+
+//---------------------------------------------------------------------
+
+// Queued events get their strings copied into the queue, direct ones are
+// processed while the strings passed by avahi are still valid.
+template <typename F>
+bool Browser::Impl::dispatch(size_t bytes, F&& build)
+{
+    avahi::CallbackScope scope;
+
+    if (_dispatch == DISPATCH_QUEUED) { return _queue.emplace(bytes, build); }
+
+    Event e;
+    Queue::Arena borrow;
+    build(e, borrow);
+
+    std::lock_guard<std::recursive_mutex> lock(_mutex);
+    process(e);
+    _queue.wake();
+    return true;
+}
+
+void Browser::Impl::process(const Event& e)
+{
+    switch (e.kind)
+    {
+        case Event::RESOLVE_FOUND:
+        case Event::RESOLVE_FAILURE: { onResolveCallback(e); break; }
+        case Event::TYPE_NEW:
+        case Event::TYPE_REMOVE:     { if (_running) onTypeCallback(e); break; }
+        default:                     { if (_running) onBrowseCallback(e); break; }
+    }
+}
+
+// Identifies the events BACKPRESSURE_COALESCE may replace by a later one: the
+// browse events of a service instance or type, the results of one resolver and
+// the state changes of one browser
+std::string Browser::Impl::key(const Event& e)
+{
+    switch (e.kind)
+    {
+        case Event::TYPE_NEW:
+        case Event::TYPE_REMOVE:
+        {
+            auto k = std::string("t");
+            k.append(e.type.data, e.type.size).push_back('\0');
+            k.append(e.domain.data, e.domain.size).push_back('\0');
+            return k + std::to_string(e.interface) + '/' + std::to_string(e.protocol);
+        }
+        case Event::BROWSE_NEW:
+        case Event::BROWSE_REMOVE:
+        {
+            auto k = std::string("b");
+            k.append(e.name.data, e.name.size).push_back('\0');
+            k.append(e.type.data, e.type.size).push_back('\0');
+            k.append(e.domain.data, e.domain.size).push_back('\0');
+            return k + std::to_string(e.interface) + '/' + std::to_string(e.protocol);
+        }
+        case Event::RESOLVE_FOUND:
+        case Event::RESOLVE_FAILURE: { return "r" + std::to_string(e.resolver); }
+        default:                     { return std::to_string(e.kind) + '/' + std::to_string(e.source); }
+    }
+}
+
+// Events whose loss would keep a resolver in the table or a browse from
+// completing. Browse and type replies can be lost like any other event.
+bool Browser::Impl::keep(const Event& e)
+{
+    switch (e.kind)
+    {
+        case Event::BROWSE_ALL_FOR_NOW:
+        case Event::BROWSE_FAILURE:
+        case Event::RESOLVE_FOUND:
+        case Event::RESOLVE_FAILURE: { return true;  }
+        default:                     { return false; }
+    }
 }
 
 //------------------------------------------------------------------------------
 // --- AVAHI Callbacks
 //------------------------------------------------------------------------------
 
-void Browser::Impl::browseCallback(AvahiServiceBrowser*, AvahiIfIndex interface, AvahiProtocol protocol,
+void Browser::Impl::browseCallback(avahi::ServiceBrowser* browser, AvahiIfIndex interface, AvahiProtocol protocol,
         AvahiBrowserEvent event, const char* name, const char* type, const char* domain,
-        AvahiLookupResultFlags flags, void* userdata)
+        AvahiLookupResultFlags, void* userdata)
 {
 	auto* THIS = static_cast<Browser::Impl*>(userdata);
-    auto n = std::string(name);
-    auto t = std::string(type);
-    auto d = std::string(domain);
-    THIS->_queue.push([=]
-    { 
-        if (THIS->_browser)
-            THIS->onBrowseCallback(interface, protocol, event, n, t, d); 
+
+    auto kind = Event::BROWSE_FAILURE;
+    switch (event)
+    {
+        case AVAHI_BROWSER_NEW:     { kind = Event::BROWSE_NEW;     break; }
+        case AVAHI_BROWSER_REMOVE:  { kind = Event::BROWSE_REMOVE;  break; }
+        case AVAHI_BROWSER_FAILURE: { kind = Event::BROWSE_FAILURE; break; }
+
+        // CACHE_EXHAUSTED only covers the daemon's cache, which is empty
+        // right after it started. ALL_FOR_NOW follows once the network had
+        // its chance to answer.
+        case AVAHI_BROWSER_ALL_FOR_NOW: { kind = Event::BROWSE_ALL_FOR_NOW; break; }
+        default:                        { return; }
+    }
+
+    auto nl = length(name);
+    auto tl = length(type);
+    auto dl = length(domain);
+    THIS->dispatch(nl + tl + dl, [&] (Event& e, Queue::Arena& arena)
+    {
+        e.kind      = kind;
+        e.source    = avahi::id(browser);
+        e.interface = interface;
+        e.protocol  = protocol;
+        e.name      = arena.copy(name,   nl);
+        e.type      = arena.copy(type,   tl);
+        e.domain    = arena.copy(domain, dl);
     });
 }
 
-void Browser::Impl::onBrowseCallback(AvahiIfIndex interface, AvahiProtocol protocol, AvahiBrowserEvent event,
-                                      std::string name, std::string type, std::string domain)
+void Browser::Impl::onBrowseCallback(const Event& e)
 {
-    switch (event)
+    // The ALL_TYPES browse reports its state here too
+    if (_typeBrowser && e.source == avahi::id(_typeBrowser.get()))
     {
-        case AVAHI_BROWSER_FAILURE: { stop(); error(ZC_BROWSER_FAILED); break; }
-        case AVAHI_BROWSER_NEW: 
+        if (e.kind == Event::BROWSE_FAILURE)     { dropType(ALL_TYPES); error(ZC_BROWSER_FAILED); }
+        if (e.kind == Event::BROWSE_ALL_FOR_NOW) { _typesBrowsed = true; checkSnapshot();         }
+        return;
+    }
+
+    // Events of a type removed meanwhile may still have been queued
+    auto browse = findBrowse(e.source);
+    if (browse == _browses.end()) return;
+
+    switch (e.kind)
+    {
+        case Event::BROWSE_FAILURE:     { dropType(browse->first); error(ZC_BROWSER_FAILED);   break; }
+        case Event::BROWSE_ALL_FOR_NOW: { browse->second.allForNow = true; checkSnapshot();    break; }
+        case Event::BROWSE_NEW: 
         {
-            avahi_service_resolver_new(_client.get(), interface, protocol, name.c_str(), type.c_str(), domain.c_str(), 
-                                       AVAHI_PROTO_UNSPEC, AVAHI_LOOKUP_USE_MULTICAST, resolveCallback, this);
+            auto  k    = serviceKey(e.name.str(), e.type.str(), e.interface);
+            auto& seen = _sightings[k];
+            if (seen & bit(e.protocol)) break;
+            seen |= bit(e.protocol);
+
+            if (_stale.erase(k)) _recovered.insert(k);
+
+            auto service      = Service();
+            service.name      = e.name.str();
+            service.type      = e.type.str();
+            service.domain    = e.domain.str();
+            service.interface = e.interface;
+            service.protocol  = fromAvahi(e.protocol);
+            service.port      = 0;
+
+            if (!_resolveOnDemand) { resolve(resolveKey(k, e.protocol), service); break; }
+
+            // Reported unresolved, resolved once resolve() asks for it
+            auto it = _services.find(k);
+            if (it == _services.end())
+            {
+                auto zcs = std::make_shared<Service>(service);
+                _services[k] = zcs;
+                serviceAdded(zcs);
+            }
+            else if (_parent->lookupPending(it->second.get()))
+                resolve(resolveKey(k, e.protocol), service);
             break; 
         }
-        case AVAHI_BROWSER_REMOVE:
+        case Event::BROWSE_REMOVE:
         {
-            auto key = name + std::to_string((int)interface);
-            if (_services.find(key) != _services.end())
-            {            
-                auto service = _services[key];
-                _services.erase(key);
+            auto k    = serviceKey(e.name.str(), e.type.str(), e.interface);
+            auto seen = _sightings.find(k);
+            if (seen == _sightings.end()) break;
+
+            seen->second &= ~bit(e.protocol);
+            if (seen->second == 0) _sightings.erase(seen);
+
+            cancelResolve(resolveKey(k, e.protocol));
+
+            auto it = _services.find(k);
+            if (it == _services.end()) break;
+
+            auto service = it->second;
+            if (_sightings.count(k))
+            {
+                setAddresses(*service, fromAvahi(e.protocol), {});
+                serviceUpdated(service);
+            }
+            else
+            {
+                unmonitor(k);
+                _services.erase(it);
                 serviceRemoved(service);
             }
-           break;
+            break;
         }
-        case AVAHI_BROWSER_ALL_FOR_NOW:
-        case AVAHI_BROWSER_CACHE_EXHAUSTED:
         default: { break; }
     }
 }
+
+Browser::Impl::Browses::iterator Browser::Impl::findBrowse(avahi::Id source)
+{
+    for (auto it = _browses.begin(); it != _browses.end(); ++it)
+        if (source && avahi::id(it->second.browser.get()) == source) return it;
+    return _browses.end();
+}
+
+//---------------------------------------------------------------------
+
+void Browser::Impl::typeCallback(avahi::TypeBrowser* browser, AvahiIfIndex interface, AvahiProtocol protocol,
+        AvahiBrowserEvent event, const char* type, const char* domain, AvahiLookupResultFlags, void* userdata)
+{
+	auto* THIS = static_cast<Browser::Impl*>(userdata);
+
+    auto kind = Event::BROWSE_FAILURE;
+    switch (event)
+    {
+        case AVAHI_BROWSER_NEW:         { kind = Event::TYPE_NEW;           break; }
+        case AVAHI_BROWSER_REMOVE:      { kind = Event::TYPE_REMOVE;        break; }
+        case AVAHI_BROWSER_ALL_FOR_NOW: { kind = Event::BROWSE_ALL_FOR_NOW; break; }
+        case AVAHI_BROWSER_FAILURE:     { kind = Event::BROWSE_FAILURE;     break; }
+        default:                        { return; }
+    }
+
+    auto tl = length(type);
+    auto dl = length(domain);
+    THIS->dispatch(tl + dl, [&] (Event& e, Queue::Arena& arena)
+    {
+        e.kind      = kind;
+        e.source    = avahi::id(browser);
+        e.interface = interface;
+        e.protocol  = protocol;
+        e.type      = arena.copy(type,   tl);
+        e.domain    = arena.copy(domain, dl);
+    });
+}
+
+// A type is announced per interface and protocol, it is gone when it has
+// vanished from all of them
+void Browser::Impl::onTypeCallback(const Event& e)
+{
+    if (!_typeBrowser || e.source != avahi::id(_typeBrowser.get())) return;
+
+    auto type = e.type.str();
+    if (e.kind == Event::TYPE_NEW)
+    {
+        if (_typeSightings[type]++ != 0) return;
+
+        auto known = _staleTypes.erase(type) != 0;
+        addType(type, true);
+        if (!known) _parent->notifyTypeAdded(type);
+        return;
+    }
+
+    auto it = _typeSightings.find(type);
+    if (it == _typeSightings.end() || --it->second != 0) return;
+    _typeSightings.erase(it);
+
+    auto browse = _browses.find(type);
+    if (browse != _browses.end() && browse->second.discovered)
+        dropType(type);
+    _parent->notifyTypeRemoved(type);
+}
+
 //---------------------------------------------------------------------
 
-void Browser::Impl::resolveCallback(AvahiServiceResolver* resolver, AvahiIfIndex interface,
+void Browser::Impl::resolveCallback(avahi::ServiceResolver* resolver, AvahiIfIndex interface,
         AvahiProtocol protocol, AvahiResolverEvent event, const char *name,
         const char *type, const char *domain, const char *host_name, const AvahiAddress *address,
-        uint16_t port, AvahiStringList *, AvahiLookupResultFlags, void* userdata)
+        uint16_t port, AvahiStringList *txt, AvahiLookupResultFlags, void* userdata)
 {
 	auto* THIS = static_cast<Browser::Impl*>(userdata);
-    auto n = std::string(name);
-    auto t = std::string(type);
-    auto d = std::string(domain);
-    auto h = std::string(host_name);
-
-    char a[AVAHI_ADDRESS_STR_MAX];
-    avahi_address_snprint(a, sizeof(a), address);
-    auto ad = std::string(a);
-
-    THIS->_queue.push([=]
-    { 
-        auto p = PROTOCOL_UNSPEC;
-        if      (protocol == AVAHI_PROTO_INET6) p = PROTOCOL_IPv6;
-        else if (protocol == AVAHI_PROTO_INET)  p = PROTOCOL_IPv4;
-        THIS->onResolveCallback(interface, p, event, n, t, d, h, ad, port);
-    
-        avahi_service_resolver_free(resolver);
+
+    auto nl = length(name);
+    auto tl = length(type);
+    auto dl = length(domain);
+    auto hl = length(host_name);
+    auto xl = txt ? avahi_string_list_serialize(txt, nullptr, 0) : 0;
+    auto wire = std::string();
+    auto queued = THIS->dispatch(nl + tl + dl + hl + xl, [&] (Event& e, Queue::Arena& arena)
+    {
+        e.kind      = (event == AVAHI_RESOLVER_FOUND) ? Event::RESOLVE_FOUND : Event::RESOLVE_FAILURE;
+        e.interface = interface;
+        e.protocol  = protocol;
+        e.resolver  = avahi::id(resolver);
+        e.error     = (event == AVAHI_RESOLVER_FAILURE) ? avahi::lastError(THIS->_client.get()) : AVAHI_OK;
+        e.port      = port;
+        e.name      = arena.copy(name,      nl);
+        e.type      = arena.copy(type,      tl);
+        e.domain    = arena.copy(domain,    dl);
+        e.host      = arena.copy(host_name, hl);
+        if (address) e.address = *address;
+
+        // Serialized into the queue, into wire when processed right away
+        auto* p = arena.allocate(xl);
+        if (!p && xl) { wire.resize(xl); p = &wire[0]; }
+        e.txt.data  = p;
+        e.txt.size  = xl ? avahi_string_list_serialize(txt, p, xl) : 0;
+    });
+    if (queued) return;
+
+    // A TXT record too large for the queue fails the resolve, its resolver is freed
+    THIS->dispatch(nl + tl + dl, [&] (Event& e, Queue::Arena& arena)
+    {
+        e.kind      = Event::RESOLVE_FAILURE;
+        e.interface = interface;
+        e.protocol  = protocol;
+        e.resolver  = avahi::id(resolver);
+        e.error     = AVAHI_ERR_NO_MEMORY;
+        e.name      = arena.copy(name,   nl);
+        e.type      = arena.copy(type,   tl);
+        e.domain    = arena.copy(domain, dl);
     });
 }
 
-void Browser::Impl::onResolveCallback(AvahiIfIndex interface, Protocol protocol, AvahiResolverEvent event, 
-                                     std::string name, std::string type, std::string domain, std::string host_name, 
-                                     std::string address, uint16_t port)
+void Browser::Impl::onResolveCallback(const Event& e)
 {
-    if (event == AVAHI_RESOLVER_FOUND) 
+    auto k  = serviceKey(e.name.str(), e.type.str(), e.interface);
+    auto rk = resolveKey(k, e.protocol);
+
+    auto w = _watchers.find(rk);
+    if (w != _watchers.end() && avahi::id(w->second) == e.resolver) { onMonitorCallback(e, k); return; }
+
+    // Results of cancelled resolvers may still have been queued, also when a
+    // new resolver took the memory of the cancelled one
+    auto it = _resolvers.find(rk);
+    if (it == _resolvers.end() || avahi::id(it->second) != e.resolver) return;
+
+    // A resolver keeps reporting changes until it is freed
+    auto keep = e.kind == Event::RESOLVE_FOUND && _monitored.enabled();
+    if (keep)
+        _watchers[rk] = it->second;
+    else
+    {
+        avahi::PollLock lock(context().poll());
+        avahi::destroy(it->second);
+    }
+    _resolvers.erase(it);
+
+    if (e.kind == Event::RESOLVE_FAILURE && e.error == AVAHI_ERR_TIMEOUT)
+        ++_resolvesTimedOut;
+
+    // A resolve() fails once no protocol is left to resolve
+    if (e.kind == Event::RESOLVE_FAILURE && !resolving(k))
     {
-        auto key   = name + std::to_string((int)interface);
-        auto isNew = _services.find(key) == _services.end();
+        auto s = _services.find(k);
+        if (s != _services.end()) _parent->lookupDone(s->second.get(), nullptr);
+    }
+
+    if (e.kind == Event::RESOLVE_FOUND)
+    {
+        auto isNew = _services.find(k) == _services.end();
 
         if (isNew) {
-            _services[key] = std::make_shared<Service>();
+            _services[k] = std::make_shared<Service>();
         }
 
-        ServicePtr zcs = _services[key];
-        zcs->name      = name;
-        zcs->type      = type;
-        zcs->domain    = domain;
-        zcs->host      = host_name;
-        zcs->interface = interface;
-        zcs->port      = port;
-        zcs->protocol  = protocol;
-        zcs->address   = address;
+        // A service found again after a restart of the daemon is only
+        // updated if it changed meanwhile
+        ServicePtr zcs = _services[k];
+        auto changed   = apply(e, *zcs);
+
+        if (isNew)                              serviceAdded(zcs);
+        else if (changed || !_recovered.count(k)) serviceUpdated(zcs);
+
+        if (keep) monitor(k);
+        _parent->lookupDone(zcs.get(), zcs);
+    }
+
+    resolveNext();
+}
+
+// Later results of a kept resolver, emitted only if something changed
+void Browser::Impl::onMonitorCallback(const Event& e, const std::string& serviceKey)
+{
+    auto it = _services.find(serviceKey);
+    if (e.kind == Event::RESOLVE_FAILURE || it == _services.end()) { unmonitor(serviceKey); return; }
+
+    if (!apply(e, *it->second)) return;
+
+    monitor(serviceKey);
+    serviceUpdated(it->second);
+}
+
+// Copies a resolve result into the service, returns true if that changed it
+bool Browser::Impl::apply(const Event& e, Service& s) const
+{
+    char address[AVAHI_ADDRESS_STR_MAX];
+    avahi_address_snprint(address, sizeof(address), &e.address);
+
+    auto before = s;
+    s.name      = e.name.str();
+    s.type      = e.type.str();
+    s.domain    = e.domain.str();
+    s.host      = e.host.str();
+    s.interface = e.interface;
+    s.port      = e.port;
+    s.txt       = TxtRecord(e.txt.view());
+    setAddresses(s, fromAvahi(e.address.proto), {address});
+    return s != before;
+}
+
+//---------------------------------------------------------------------
+
+void Browser::Impl::resolve(const std::string& key, const Service& service)
+{
+    if (_resolvers.count(key) || _backlog.contains(key) || _watchers.count(key)) return;
+
+    if (_maxResolves && _resolvers.size() >= _maxResolves)
+        _backlog.push(key, service);
+    else
+        startResolve(key, service);
+
+    resolvesChanged();
+}
+
+// Resolves the address of the protocol the instance was seen on
+void Browser::Impl::startResolve(const std::string& key, const Service& s)
+{
+    auto protocol = toAvahi(s.protocol);
+
+    if (!_client) return;
+
+    avahi::PollLock lock(context().poll());
+    auto* resolver = avahi::newServiceResolver(_client.get(), (AvahiIfIndex)s.interface, protocol, s.name.c_str(), s.type.c_str(),
+                                               s.domain.c_str(), protocol, AVAHI_LOOKUP_USE_MULTICAST, resolveCallback, this);
+    if (resolver)
+        _resolvers[key] = resolver;
+}
+
+void Browser::Impl::cancelResolve(const std::string& key)
+{
+    if (_backlog.erase(key)) { resolvesChanged(); return; }
+
+    auto w = _watchers.find(key);
+    if (w != _watchers.end())
+    {
+        avahi::PollLock lock(context().poll());
+        avahi::destroy(w->second);
+        _watchers.erase(w);
+    }
+
+    auto it = _resolvers.find(key);
+    if (it == _resolvers.end()) return;
+
+    {
+        avahi::PollLock lock(context().poll());
+        avahi::destroy(it->second);
+    }
+    _resolvers.erase(it);
+
+    resolveNext();
+}
+
+bool Browser::Impl::resolving(const std::string& serviceKey) const
+{
+    for (auto p : {AVAHI_PROTO_INET, AVAHI_PROTO_INET6})
+    {
+        auto k = resolveKey(serviceKey, p);
+        if (_resolvers.count(k) || _backlog.contains(k)) return true;
+    }
+    return false;
+}
+
+void Browser::Impl::resolveNext()
+{
+    while (!_backlog.empty() && (!_maxResolves || _resolvers.size() < _maxResolves))
+    {
+        auto next = _backlog.pop();
+        startResolve(next.first, next.second);
+    }
+    resolvesChanged();
+}
+
+void Browser::Impl::resolvesChanged()
+{
+    _resolvesInFlight = _resolvers.size();
+    _resolvesQueued   = _backlog.size();
+    checkSnapshot();
+}
+
+// Waits for ALL_FOR_NOW of every browse, the types found by ALL_TYPES until
+// then included, and for the resolves they started. A resync after a restart
+// of the daemon ends at the same point.
+void Browser::Impl::checkSnapshot()
+{
+    if (!_running || !_client || _resyncing) return;
+    if (_browses.empty() && !_allTypes) return;
+    if (_allTypes && !_typesBrowsed) return;
+    for (const auto& b : _browses)
+        if (!b.second.allForNow) return;
+    if (!_resolvers.empty() || !_backlog.empty()) return;
+
+    finishResync();
+    if (_snapshotDone) return;
+
+    _snapshotDone = true;
+    _parent->notifySnapshotComplete();
+}
+
+//---------------------------------------------------------------------
+
+// Marks an instance as used, demoting the least recently used one beyond the cap
+void Browser::Impl::monitor(const std::string& serviceKey)
+{
+    auto demoted = std::string();
+    if (_monitored.touch(serviceKey, demoted))
+        unmonitor(demoted);
+
+    _monitoredCount = _monitored.size();
+}
+
+// Frees the kept resolvers, the service stays with what they reported last
+void Browser::Impl::unmonitor(const std::string& serviceKey)
+{
+    _monitored.erase(serviceKey);
+    _monitoredCount = _monitored.size();
+
+    avahi::PollLock lock(context().poll());
+    for (auto p : {AVAHI_PROTO_INET, AVAHI_PROTO_INET6})
+    {
+        auto it = _watchers.find(resolveKey(serviceKey, p));
+        if (it == _watchers.end()) continue;
 
-        if (isNew) serviceAdded(zcs);
-        else       serviceUpdated(zcs);
+        avahi::destroy(it->second);
+        _watchers.erase(it);
     }
 }
 
@@ -218,14 +1166,25 @@ void Browser::Impl::onResolveCallback(AvahiIfIndex interface, Protocol protocol,
 //--- Browser
 //---------------------------------------------------------------------
 
-Browser::Browser()  { _impl = std::make_unique<Impl>(this); }
+Browser::Browser()                              : Browser(Options()) {}
+Browser::Browser(const Options& options)        { init(options); _impl = std::make_unique<Impl>(this, options); }
 Browser::~Browser() = default;
 
 //---------------------------------------------------------------------
 
-void Browser::poll()                            { _impl->poll();      }
-void Browser::start(const std::string& type)	{ _impl->start(type); }
-void Browser::stop() 							{ _impl->stop();      }
+void Browser::poll()                                             { _impl->poll(); }
+void Browser::pollBatch(Batch& batch)                            { _impl->poll(&batch); }
+void Browser::poll(std::chrono::milliseconds timeout)            { _impl->poll(flushTimeout(timeout)); }
+std::vector<ServicePtr> Browser::services() const                { return _impl->services(); }
+Browser::Statistics Browser::queueStatistics() const             { return _impl->statistics(); }
+int Browser::nativeHandle() const                                { return _impl->nativeHandle(); }
+Connection Browser::subscribe(const ChangeHandler& h)            { return _impl->subscribe(h); }
+std::shared_future<ServicePtr> Browser::resolve(ServicePtr s)    { return _impl->request(s); }
+void Browser::start(const std::string& type, Protocol protocol)  { _impl->start(type, protocol); }
+void Browser::stop()                                             { _impl->stop(); }
+void Browser::addType(const std::string& type)                   { _impl->addType(type); }
+void Browser::removeType(const std::string& type)                { _impl->removeType(type); }
+std::vector<std::string> Browser::types() const                  { return _impl->types(); }
 
 }
 
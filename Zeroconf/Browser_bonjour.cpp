@@ -1,12 +1,19 @@
 #include "Browser.h"
 #include <dns_sd.h>
 
-#include <boost/lockfree/spsc_queue.hpp>
+#include "Context_bonjour.h"
+#include "EventQueue.h"
+#include "MonitorList.h"
+#include "ResolveBacklog.h"
 
-#include <thread>
+#include <algorithm>
+#include <atomic>
 #include <map>
+#include <mutex>
+#include <set>
 #include <vector>
 #include <string>
+#include <cstring>
 #include <iostream>
 #include <arpa/inet.h>
 
@@ -56,45 +63,231 @@ namespace convert
 
         return s;
     }
+
+    DNSServiceProtocol getDNSServiceProtocol(Protocol p)
+    {
+        switch (p)
+        {
+            case PROTOCOL_IPv4:   { return kDNSServiceProtocol_IPv4; }
+            case PROTOCOL_IPv6:   { return kDNSServiceProtocol_IPv6; }
+            case PROTOCOL_UNSPEC: { break; }
+        }
+        return kDNSServiceProtocol_IPv4 | kDNSServiceProtocol_IPv6;
+    }
 }
 
 //---------------------------------------------------------------------
 
 class Browser::Impl
 {
-    using QueueEvent = std::function<void()>;
-    using Queue      = boost::lockfree::spsc_queue<QueueEvent>;
+    // Operations are told apart by the id the context gives them, the memory
+    // of a released ref is reused by the next one
+    using Id = Context::Impl::Id;
+
+    // Replies handed from the reactor thread to poll()
+    struct Event
+    {
+        enum Kind { BROWSE, BROWSE_FAILURE, RESOLVED, ADDRESS, RESOLVE_FAILURE,
+                    MONITOR_RESOLVED, MONITOR_ADDRESS, MONITOR_FAILURE, RECONNECT, DRAINED, QUIET };
+
+        union Address
+        {
+            struct sockaddr     sa;
+            struct sockaddr_in  v4;
+            struct sockaddr_in6 v6;
+        };
+
+        Kind            kind      = BROWSE_FAILURE;
+        DNSServiceFlags flags     = 0;
+        Id              id        = 0;      // of the operation replying
+        DNSServiceErrorType error = kDNSServiceErr_NoError;     // failures only
+        uint32_t        interface = 0;
+        uint16_t        port      = 0;
+        Address         address   = {};
+        Text            name;
+        Text            type;
+        Text            domain;
+        Text            host;
+        Text            txt;        // wire format
+    };
+
+    using Queue = EventQueue<Event>;
+
+    // The browse of one service type
+    struct Browse
+    {
+        DNSServiceRef ref        = nullptr;
+        Id            id         = 0;
+        std::string   regtype;                  // as reported by dnssd, with domain
+        bool          discovered = false;       // added by the ALL_TYPES browse
+        bool          browsed    = false;       // the end of a burst of replies seen, or QUIET
+        bool          pending    = false;       // the last reply had MoreComing
+    };
+
+    // mDNSResponder doesn't reply to the browse of a type without instances.
+    // A browse which didn't reply for this long counts as complete.
+    static constexpr std::chrono::milliseconds QUIET_TIME = std::chrono::seconds(1);
+
+    // One resolve in flight: the service it fills in and the ref of its
+    // resolve, then of its address query. The protocols which answered the
+    // address query so far, a bit per Protocol.
+    struct Slot
+    {
+        ServicePtr    service;
+        DNSServiceRef ref      = nullptr;
+        Id            id       = 0;
+        unsigned      answered = 0;
+        bool          changed  = false;     // addresses not reported yet
+        bool          reported = false;
+        bool          pending  = false;     // the last reply had MoreComing
+    };
+
+    // Continuous resolution of one service, see Options::monitorServices
+    struct Monitor
+    {
+        ServicePtr    service;
+        DNSServiceRef resolver   = nullptr;
+        DNSServiceRef address    = nullptr;
+        Id            resolverId = 0;
+        Id            addressId  = 0;
+    };
 
 public:
-	Impl(Browser* parent);
+	Impl(Browser* parent, const Options& options);
 	~Impl();
 
-    void poll();
+    void poll(Batch* batch = nullptr);
+    void poll(std::chrono::milliseconds timeout);
+    std::vector<ServicePtr> services() const;
+    Statistics statistics() const;
+    int nativeHandle() const { return _queue.nativeHandle(); }
+    Connection subscribe(const ChangeHandler& handler);
+    std::shared_future<ServicePtr> request(ServicePtr service);
 
-	void start(const std::string& type);
+	void start(const std::string& type, Protocol protocol);
 	void stop();
+    void addType(const std::string& type);
+    void removeType(const std::string& type);
+    std::vector<std::string> types() const;
 
 private:
 
-    void error(Browser::Error e)        { _parent->_error(e);           }
-    void serviceAdded(ServicePtr s)     { _parent->_serviceAdded(s);    }
-    void serviceUpdated(ServicePtr s)   { _parent->_serviceUpdated(s);  }
-    void serviceRemoved(ServicePtr s)   { _parent->_serviceRemoved(s);  }
-
-	void resolve();
-    void stopResolve(bool all=false);
-
-    void browseCallback(DNSServiceFlags, uint32_t interface, std::string name, std::string type, std::string domain);
-    void resolverCallback(uint32_t interface, std::string hostName, uint16_t port);
-    void addressCallback(DNSServiceFlags, uint32_t interface, std::string address, Protocol);
-
+    // Instances are told apart by type, name and interface
+    static std::string serviceKey(const std::string& name, const std::string& type, uint32_t interface)
+    { return type + '\0' + name + '\0' + std::to_string(interface); }
+    static std::string serviceKey(const Service& s) { return serviceKey(s.name, s.type, s.interface); }
+
+    Context::Impl& context() const      { return *_context->_impl;      }
+    void error(Browser::Error e)        { _parent->notifyError(e);      }
+    void serviceAdded(ServicePtr s)     { _parent->notifyAdded(s);      }
+    void serviceUpdated(ServicePtr s)   { _parent->notifyUpdated(s);    }
+    void serviceRemoved(ServicePtr s)   { _parent->notifyRemoved(s);    }
+
+    void resolve(const ServicePtr& service);
+    void startResolve(const std::string& key, const ServicePtr& service);
+    void finishResolve(const std::string& key);
+    void cancelResolve(const std::string& key);
+    void resolveNext();
+    void stopResolves();
+
+    template <typename F>
+    bool dispatch(size_t bytes, F&& build, DNSServiceFlags flags = 0);
+    void post(Event::Kind kind, Id id = 0, DNSServiceErrorType err = kDNSServiceErr_NoError);
+    void process(const Event& e);
+    static std::string key(const Event& e);
+    static bool keep(const Event& e);
+
+    void browseCallback(const Event& e);
+    void typeCallback(const Event& e);
+    void addType(const std::string& type, bool discovered);
+    DNSServiceErrorType startBrowse(const std::string& type, Browse& browse);
+    DNSServiceErrorType startTypeBrowse();
+    void expectQuiet(DNSServiceRef ref, Id id);
+    void stopBrowses();
+    void dropType(const std::string& type);
+    void drop(const std::string& key);
+    void resolverCallback(const Event& e, const std::string& key);
+    void checkSnapshot();
+
+    bool owns(Id id) const;
+    void disconnect();
+    void reconnect();
+    void finishResync();
+    void addressCallback(const Event& e, const std::string& key);
+    void addressesDone(const std::string& key);
+    void drained();
+    void quiet(Id id);
+    void resolved(Slot& slot);
+
+    void monitor(const ServicePtr& service);
+    void unmonitor(const std::string& key);
+    void watchAddress(Monitor& m);
+    DNSServiceErrorType run(DNSServiceRef& ref, Id& id, Event::Kind failure, const Context::Impl::Call& call);
+    void monitorResolved(const Event& e);
+    void monitorAddress(const Event& e);
+    Monitor* findMonitor(Id id);
+
+    std::shared_ptr<Context> _context;
 	Browser*           _parent = nullptr;
+    Dispatch           _dispatch;
     Queue              _queue;
-	DNSServiceRef      _browser  = nullptr;
-	DNSServiceRef      _resolver = nullptr;
+    std::vector<Event> _taken;          // reused by poll()
+    size_t             _lost     = 0;   // drops already reported by poll()
+    Protocol           _protocol = PROTOCOL_IPv4;
+    const bool         _resolveOnDemand;
+    bool               _running  = false;
+
+    // Browses by type, and the ALL_TYPES browse with the number of interfaces
+    // each type it found is seen on. While disconnected the browses are kept
+    // without their service refs.
+    std::map<std::string, Browse>   _browses;
+    DNSServiceRef                   _typeBrowser  = nullptr;
+    Id                              _typeBrowserId = 0;
+    std::map<std::string, unsigned> _typeSightings;
+    bool                            _allTypes     = false;
+    bool                            _typesBrowsed = false;
+    bool                            _typesPending = false;
+
+    // Between the loss of mDNSResponder and the browses being back. The
+    // services and types known before that weren't seen again yet are
+    // removed when the browses are complete again.
+    bool                            _disconnected = false;
+    std::set<std::string>           _stale;
+    std::set<std::string>           _staleTypes;
+    bool                            _resyncing    = false;
+    Connection                      _stateConnection;
+    Connection                      _drainedConnection;
+
+    // A reply with MoreComing was dispatched since the reactor last drained
+    // the socket. Reactor thread, under the context lock.
+    bool                            _moreComing = false;
+
+    // Whether snapshotComplete was emitted since start()
+    bool               _snapshotDone = false;
 
 	std::map<std::string, ServicePtr> _services;
-    std::vector<ServicePtr>           _work;
+
+    // Resolves in flight by service key, and the key of each of their operations.
+    // Beyond Options::maxResolves they wait in the backlog, _queued holds the
+    // services it stands for.
+    std::map<std::string, Slot>          _slots;
+    std::map<Id, std::string>            _slotIds;
+    ResolveBacklog                       _backlog;
+    std::map<std::string, ServicePtr>    _queued;
+    const size_t                         _maxResolves;
+    std::atomic<size_t>                  _resolvesTimedOut = {0};
+
+    // Monitored services by key, in order of use, and the key of each of
+    // their operations
+    std::map<std::string, Monitor>       _monitors;
+    MonitorList                          _monitored;
+    std::map<Id, std::string>            _monitorIds;
+
+    // Guards the browser state against the reactor thread in direct dispatch
+    mutable std::recursive_mutex      _mutex;
+
+    // Serializes poll(), taken before the reactor lock
+    std::recursive_mutex              _pollMutex;
 
 
     // --- Bonjour Callbacks
@@ -107,104 +300,646 @@ private:
 
     static void DNSSD_API onAddressCallback(DNSServiceRef sdRef, DNSServiceFlags flags, uint32_t interfaceIndex,
             DNSServiceErrorType err, const char*, const struct sockaddr* address, uint32_t ttl, void *userdata);
+
+    static void DNSSD_API onMonitorResolved(DNSServiceRef sdRef, DNSServiceFlags, uint32_t, DNSServiceErrorType err, const char *,
+            const char *hostName, uint16_t port, uint16_t txtLen, const char * txtRecord, void *userdata);
+
+    static void DNSSD_API onMonitorAddress(DNSServiceRef sdRef, DNSServiceFlags flags, uint32_t interfaceIndex,
+            DNSServiceErrorType err, const char*, const struct sockaddr* address, uint32_t ttl, void *userdata);
 };
 
 //---------------------------------------------------------------------
 
-Browser::Impl::Impl(Browser *parent)
-: _parent(parent)
-, _queue(20)
-{}
+Browser::Impl::Impl(Browser *parent, const Options& options)
+: _context(options.context ? options.context : Context::shared())
+, _parent(parent)
+, _dispatch(options.dispatch)
+, _queue(options.queueCapacity, options.backpressure, &Impl::key, &Impl::keep)
+, _resolveOnDemand(options.resolveOnDemand)
+, _backlog(options.resolvePriority)
+, _maxResolves(options.maxResolves)
+, _monitored(options.monitorServices)
+{
+    _stateConnection   = context().connectStateChanged([this] { post(Event::RECONNECT); });
+    _drainedConnection = context().connectDrained([this]
+    {
+        if (_moreComing) { _moreComing = false; post(Event::DRAINED); }
+    });
+}
 
 Browser::Impl::~Impl()
 {
+    context().disconnect(_stateConnection);
+    context().disconnect(_drainedConnection);
+
+    auto reactor = context().lock();
     stop();
-    stopResolve(true);
 }
 
 //---------------------------------------------------------------------
 
-void Browser::Impl::poll()
+// Handlers run once the locks are released and may call start() or stop().
+// The batch is set under the lock of direct dispatch, which collects into it
+// meanwhile.
+void Browser::Impl::poll(Batch* batch)
 {
-    _queue.consume_all([] (const auto& e) { e(); });
+    // Taken out before the reactor lock, which a reactor waiting for room
+    // under BACKPRESSURE_BLOCK holds
+    std::lock_guard<std::recursive_mutex> polling(_pollMutex);
+    auto events = std::vector<Event>();
+    events.swap(_taken);
+    _queue.take(events);
+
+    {
+        auto reactor = context().lock();
+        std::lock_guard<std::recursive_mutex> lock(_mutex);
+        _parent->_batch = batch;
+        _parent->holdSignals(true);
+
+        for (const auto& e : events) process(e);
+        _queue.taken();
+        events.clear();
+        _taken.swap(events);
+        _parent->flushUpdates();
+
+        auto dropped = _queue.dropped();
+        if (dropped != _lost) { _lost = dropped; error(ZC_BROWSER_EVENTS_LOST); }
+
+        _parent->_batch = nullptr;
+        _parent->holdSignals(false);
+    }
+    _parent->emitHeld();
 }
 
-//---------------------------------------------------------------------
+// Queued events get their strings copied into the queue, direct ones are
+// processed while the strings passed by dnssd are still valid. While dnssd has
+// more replies coming the queued ones are held back, poll() gets the burst in
+// one drain. The last reply of a burst may be for another browser of the
+// context, DRAINED then ends it once the socket is drained.
+template <typename F>
+bool Browser::Impl::dispatch(size_t bytes, F&& build, DNSServiceFlags flags)
+{
+    auto more = (flags & kDNSServiceFlagsMoreComing) != 0;
+    if (more) _moreComing = true;
 
-void Browser::Impl::start(const std::string& type)
+    if (_dispatch == DISPATCH_QUEUED)
+    {
+        if (more) _queue.hold();
+        auto queued = _queue.emplace(bytes, build);
+        if (!more) _queue.publish();
+        return queued;
+    }
+
+    Event e;
+    Queue::Arena borrow;
+    build(e, borrow);
+
+    std::lock_guard<std::recursive_mutex> lock(_mutex);
+    process(e);
+    _queue.wake();
+    return true;
+}
+
+void Browser::Impl::post(Event::Kind kind, Id id, DNSServiceErrorType err)
 {
-	if (_browser) { error(ZC_BROWSER_ALRADY_RUNNING); return; }
+    dispatch(0, [=] (Event& e, Queue::Arena&) { e.kind = kind; e.id = id; e.error = err; });
+}
 
-	auto err  = DNSServiceBrowse(&_browser, 0, 0, type.c_str(), 0,
-                                 (DNSServiceBrowseReply) Browser::Impl::onBrowseCallback, this);
+void Browser::Impl::process(const Event& e)
+{
+    switch (e.kind)
+    {
+        case Event::BROWSE:          { browseCallback(e);                break; }
+        case Event::RECONNECT:       { reconnect();                      break; }
+        case Event::DRAINED:         { drained();                        break; }
+        case Event::QUIET:           { quiet(e.id);                      break; }
+        case Event::BROWSE_FAILURE:
+        {
+            // Failures of browses removed meanwhile may still have been queued
+            if (e.error == kDNSServiceErr_ServiceNotRunning && owns(e.id)) { disconnect(); break; }
+            if (_typeBrowserId && e.id == _typeBrowserId) { dropType(ALL_TYPES); error(ZC_BROWSER_FAILED); break; }
+            for (const auto& b : _browses)
+            {
+                if (b.second.id != e.id) continue;
+                dropType(std::string(b.first));
+                error(ZC_BROWSER_FAILED);
+                break;
+            }
+            break;
+        }
+        case Event::RESOLVED:
+        case Event::ADDRESS:
+        case Event::RESOLVE_FAILURE:
+        {
+            // Replies of a resolve stopped meanwhile may still have been queued
+            auto it = _slotIds.find(e.id);
+            if (!_running || it == _slotIds.end()) break;
+
+            auto key = it->second;
+            if      (e.kind == Event::RESOLVED) { resolverCallback(e, key); break; }
+            else if (e.kind == Event::ADDRESS)  { addressCallback(e, key);  break; }
+
+            // A query timing out keeps the addresses it found until then
+            if (e.error == kDNSServiceErr_Timeout) ++_resolvesTimedOut;
+            auto& slot = _slots[key];
+            if (slot.changed && (slot.reported || !slot.service->addresses.empty())) resolved(slot);
+            finishResolve(key);
+            break;
+        }
+        case Event::MONITOR_RESOLVED: { monitorResolved(e);              break; }
+        case Event::MONITOR_ADDRESS:  { monitorAddress(e);               break; }
+        case Event::MONITOR_FAILURE:
+        {
+            if (e.error == kDNSServiceErr_ServiceNotRunning && owns(e.id)) { disconnect(); break; }
 
-    if (err != kDNSServiceErr_NoError) {
-        stop();
-        error(ZC_BROWSER_FAILED);
-        return;
+            auto it = _monitorIds.find(e.id);
+            if (it != _monitorIds.end()) unmonitor(it->second);
+            break;
+        }
     }
+}
 
-    std::thread t([this]()
+// Identifies the events BACKPRESSURE_COALESCE may replace by a later one.
+// Browse failures and the replies of resolves and monitors are told apart by
+// operation, addresses by address.
+std::string Browser::Impl::key(const Event& e)
+{
+    switch (e.kind)
     {
-        auto err = DNSServiceProcessResult(_browser);
-        if (err != kDNSServiceErr_NoError)
+        case Event::BROWSE:
         {
-           _queue.push([this]{ stop(); error(ZC_BROWSER_FAILED); });
+            auto k = std::string("b");
+            k.append(e.name.data, e.name.size).push_back('\0');
+            k.append(e.type.data, e.type.size).push_back('\0');
+            k.append(e.domain.data, e.domain.size).push_back('\0');
+            return k + std::to_string(e.interface);
         }
-    });
-    t.detach();
+        case Event::BROWSE_FAILURE:
+        case Event::QUIET:
+        case Event::RESOLVED:
+        case Event::ADDRESS:
+        case Event::RESOLVE_FAILURE:
+        case Event::MONITOR_RESOLVED:
+        case Event::MONITOR_FAILURE:
+        case Event::MONITOR_ADDRESS:
+        {
+            auto k       = "m" + std::to_string(e.id) + '/' + std::to_string(e.kind);
+            auto address = e.kind == Event::ADDRESS || e.kind == Event::MONITOR_ADDRESS;
+            return address ? k + '/' + convert::getAddress(&e.address.sa) : k;
+        }
+        default: { return std::to_string(e.kind); }
+    }
+}
+
+// Events whose loss would keep a resolve slot taken, a browse from
+// completing or the browser from reconnecting. Browse replies and monitor
+// updates can be lost like any other event.
+bool Browser::Impl::keep(const Event& e)
+{
+    switch (e.kind)
+    {
+        case Event::BROWSE:
+        case Event::MONITOR_RESOLVED:
+        case Event::MONITOR_ADDRESS: { return false; }
+        default:                     { return true;  }
+    }
+}
+
+void Browser::Impl::poll(std::chrono::milliseconds timeout)
+{
+    _queue.wait(timeout);
+    poll();
+}
+
+std::vector<ServicePtr> Browser::Impl::services() const
+{
+    std::lock_guard<std::recursive_mutex> lock(_mutex);
+
+    auto result = std::vector<ServicePtr>();
+    result.reserve(_services.size());
+    for (const auto& s : _services)
+        result.push_back(s.second);
+    return result;
+}
+
+Browser::Statistics Browser::Impl::statistics() const
+{
+    std::lock_guard<std::recursive_mutex> lock(_mutex);
+
+    auto s = Statistics();
+    s.queued    = _queue.size();
+    s.dropped   = _queue.dropped();
+    s.coalesced = _queue.coalesced();
+    s.highWater = _queue.highWater();
+    s.resolvesInFlight = _slots.size();
+    s.resolvesQueued   = _backlog.size();
+    s.resolvesTimedOut = _resolvesTimedOut;
+    s.monitored        = _monitors.size();
+    return s;
+}
+
+Connection Browser::Impl::subscribe(const ChangeHandler& handler)
+{
+    std::lock_guard<std::recursive_mutex> lock(_mutex);
+
+    for (const auto& s : _services)
+        handler(ADDED, s.second);
+    return _parent->_changed.connect(handler);
+}
+
+//---------------------------------------------------------------------
+
+void Browser::Impl::start(const std::string& type, Protocol protocol)
+{
+    auto reactor = context().lock();
+    std::lock_guard<std::recursive_mutex> lock(_mutex);
+
+	if (_running) { error(ZC_BROWSER_ALRADY_RUNNING); return; }
+    _protocol     = protocol;
+    _snapshotDone = false;
+    addType(type, false);
 }
 
 void Browser::Impl::stop()
 {
-    if (_browser) {
-        DNSServiceRefDeallocate(_browser);
-        _browser = nullptr;
+    auto reactor = context().lock();
+    std::lock_guard<std::recursive_mutex> lock(_mutex);
+
+    while (!_monitors.empty())
+        unmonitor(_monitors.begin()->first);
+    stopResolves();
+
+    if (_running) {
+        _running = false;
+        stopBrowses();
+        _browses.clear();
+        _allTypes = false;
+        _typeSightings.clear();
+        _stale.clear();
+        _staleTypes.clear();
+
         _services.clear();
+        _parent->notifyCleared();
     }
 }
 
 //---------------------------------------------------------------------
 
-void Browser::Impl::resolve()
+void Browser::Impl::addType(const std::string& type)
 {
-    if (_work.empty() || _resolver) return;
+    auto reactor = context().lock();
+    std::lock_guard<std::recursive_mutex> lock(_mutex);
+    addType(type, false);
+}
 
-    auto service = _work.front();
-    auto err     = DNSServiceResolve(&_resolver, kDNSServiceFlagsTimeout, service->interface, service->name.c_str(),
-                                     service->type.c_str(), service->domain.c_str(), (DNSServiceResolveReply) Browser::Impl::onResolverCallback, this);
+// Types found by ALL_TYPES are browsed until they go away, unless they were
+// also added by hand. While disconnected they are browsed by reconnect().
+void Browser::Impl::addType(const std::string& type, bool discovered)
+{
+    _running = true;
 
-    if (err != kDNSServiceErr_NoError) {
-        stopResolve();
+    if (type == ALL_TYPES)
+    {
+        if (_allTypes) return;
+
+        _allTypes     = true;
+        _typesBrowsed = false;
+        if (!_disconnected && startTypeBrowse() != kDNSServiceErr_NoError) { _allTypes = false; error(ZC_BROWSER_FAILED); }
         return;
     }
 
-    std::thread t([this]()
+    auto it = _browses.find(type);
+    if (it != _browses.end()) { it->second.discovered &= discovered; return; }
+
+    auto& browse      = _browses[type];
+    browse.discovered = discovered;
+    if (!_disconnected && startBrowse(type, browse) != kDNSServiceErr_NoError) { _browses.erase(type); error(ZC_BROWSER_FAILED); }
+}
+
+DNSServiceErrorType Browser::Impl::startBrowse(const std::string& type, Browse& browse)
+{
+    browse.browsed = false;
+    browse.pending = false;
+    auto err = run(browse.ref, browse.id, Event::BROWSE_FAILURE, [&] (DNSServiceRef* ref, DNSServiceFlags flags)
     {
-        auto err = DNSServiceProcessResult(_resolver);
-        if (err != kDNSServiceErr_NoError)
-        {
-            _queue.push([this]{ stopResolve(); });
-        }
+        return DNSServiceBrowse(ref, flags, 0, type.c_str(), 0, (DNSServiceBrowseReply) Browser::Impl::onBrowseCallback, this);
     });
-    t.detach();
+    if (err == kDNSServiceErr_NoError) expectQuiet(browse.ref, browse.id);
+    return err;
 }
 
-void Browser::Impl::stopResolve(bool all)
+DNSServiceErrorType Browser::Impl::startTypeBrowse()
 {
-    if (!_resolver)
+    _typesBrowsed = false;
+    _typesPending = false;
+    auto err = run(_typeBrowser, _typeBrowserId, Event::BROWSE_FAILURE, [&] (DNSServiceRef* ref, DNSServiceFlags flags)
     {
-        DNSServiceRefDeallocate(_resolver);
-        _resolver = nullptr;
+        return DNSServiceBrowse(ref, flags, 0, ALL_TYPES, 0, (DNSServiceBrowseReply) Browser::Impl::onBrowseCallback, this);
+    });
+    if (err == kDNSServiceErr_NoError) expectQuiet(_typeBrowser, _typeBrowserId);
+    return err;
+}
 
-        if (all)
-            _work.clear();
-        else
-        {
-            _work.erase(_work.begin());
-            resolve();
-        }
+// The timer goes with the ref, it can't fire for a released browse
+void Browser::Impl::expectQuiet(DNSServiceRef ref, Id id)
+{
+    context().schedule(ref, QUIET_TIME, [this, id] { post(Event::QUIET, id); });
+}
+
+// Deallocates the service refs of all browses, the browses stay
+void Browser::Impl::stopBrowses()
+{
+    for (auto& b : _browses)
+    {
+        context().release(b.second.ref);
+        b.second.ref = nullptr;
+        b.second.id  = 0;
+    }
+    context().release(_typeBrowser);
+    _typeBrowser   = nullptr;
+    _typeBrowserId = 0;
+}
+
+void Browser::Impl::removeType(const std::string& type)
+{
+    auto reactor = context().lock();
+    std::lock_guard<std::recursive_mutex> lock(_mutex);
+    dropType(type);
+}
+
+void Browser::Impl::dropType(const std::string& type)
+{
+    if (type == ALL_TYPES)
+    {
+        context().release(_typeBrowser);
+        _typeBrowser   = nullptr;
+        _typeBrowserId = 0;
+        _allTypes      = false;
+        _typeSightings.clear();
+        _staleTypes.clear();
+
+        auto discovered = std::vector<std::string>();
+        for (const auto& b : _browses)
+            if (b.second.discovered) discovered.push_back(b.first);
+        for (const auto& t : discovered)
+            dropType(t);
+
+        checkSnapshot();
+        return;
+    }
+
+    auto it = _browses.find(type);
+    if (it == _browses.end()) return;
+
+    auto regtype = it->second.regtype;
+    context().release(it->second.ref);
+    _browses.erase(it);
+
+    // Instances are keyed by the type dnssd reports, the instances of a
+    // browse which hasn't replied yet are neither known nor in the works
+    if (!regtype.empty())
+    {
+        auto prefix = regtype + '\0';
+        auto keys   = std::vector<std::string>();
+        for (auto s = _services.lower_bound(prefix); s != _services.end() && s->first.compare(0, prefix.size(), prefix) == 0; ++s)
+            keys.push_back(s->first);
+        for (const auto& k : _slots)
+            if (k.first.compare(0, prefix.size(), prefix) == 0) keys.push_back(k.first);
+        for (const auto& k : _queued)
+            if (k.first.compare(0, prefix.size(), prefix) == 0) keys.push_back(k.first);
+
+        for (const auto& k : keys)
+            drop(k);
+    }
+    checkSnapshot();
+}
+
+std::vector<std::string> Browser::Impl::types() const
+{
+    std::lock_guard<std::recursive_mutex> lock(_mutex);
+
+    auto result = std::vector<std::string>();
+    if (_allTypes) result.push_back(ALL_TYPES);
+    for (const auto& b : _browses)
+        result.push_back(b.first);
+    return result;
+}
+
+// Forgets an instance, stops its resolve and emits serviceRemoved if it was reported
+void Browser::Impl::drop(const std::string& key)
+{
+    unmonitor(key);
+    cancelResolve(key);
+
+    auto it = _services.find(key);
+    if (it == _services.end()) return;
+
+    auto service = it->second;
+    _services.erase(it);
+    serviceRemoved(service);
+}
+
+//---------------------------------------------------------------------
+
+void Browser::Impl::resolve(const ServicePtr& service)
+{
+    auto key = serviceKey(*service);
+    if (_slots.count(key) || _queued.count(key)) return;
+
+    if (_maxResolves && _slots.size() >= _maxResolves)
+    {
+        _backlog.push(key, *service);
+        _queued[key] = service;
+    }
+    else
+        startResolve(key, service);
+}
+
+// The resolve and the address query after it time out in the daemon, a slot
+// never stays taken for good
+void Browser::Impl::startResolve(const std::string& key, const ServicePtr& service)
+{
+    auto slot    = Slot();
+    slot.service = service;
+    auto err     = run(slot.ref, slot.id, Event::RESOLVE_FAILURE, [&] (DNSServiceRef* ref, DNSServiceFlags flags)
+    {
+        return DNSServiceResolve(ref, flags | kDNSServiceFlagsTimeout, service->interface, service->name.c_str(),
+                                 service->type.c_str(), service->domain.c_str(), (DNSServiceResolveReply) Browser::Impl::onResolverCallback, this);
+    });
+
+    if (err != kDNSServiceErr_NoError) { _parent->lookupDone(service.get(), nullptr); return; }
+
+    _slotIds[slot.id] = key;
+    _slots[key]       = slot;
+}
+
+// Frees the slot and hands it to the next resolve waiting
+void Browser::Impl::finishResolve(const std::string& key)
+{
+    auto it = _slots.find(key);
+    if (it == _slots.end()) return;
+
+    auto service = it->second.service;
+    _slotIds.erase(it->second.id);
+    context().release(it->second.ref);
+    _slots.erase(it);
+
+    // Fails a resolve() still waiting, after a success this does nothing
+    _parent->lookupDone(service.get(), nullptr);
+    resolveNext();
+}
+
+void Browser::Impl::cancelResolve(const std::string& key)
+{
+    auto it = _queued.find(key);
+    if (it == _queued.end()) { finishResolve(key); return; }
+
+    _parent->lookupDone(it->second.get(), nullptr);
+    _backlog.erase(key);
+    _queued.erase(it);
+}
+
+void Browser::Impl::resolveNext()
+{
+    while (!_backlog.empty() && (!_maxResolves || _slots.size() < _maxResolves))
+    {
+        auto key     = _backlog.pop().first;
+        auto service = _queued[key];
+        _queued.erase(key);
+        startResolve(key, service);
     }
+    checkSnapshot();
+}
+
+// Pending resolve() calls get nullptr
+void Browser::Impl::stopResolves()
+{
+    for (const auto& slot : _slots)
+        _parent->lookupDone(slot.second.service.get(), nullptr);
+    for (const auto& q : _queued)
+        _parent->lookupDone(q.second.get(), nullptr);
+
+    for (const auto& slot : _slots)
+        context().release(slot.second.ref);
+    _slots.clear();
+    _slotIds.clear();
+    _backlog.clear();
+    _queued.clear();
+}
+
+// Waits for the end of a burst from every browse, or QUIET_TIME without a
+// reply, the types found by ALL_TYPES until then included, and for the
+// resolves they started. A resync
+// after a restart of mDNSResponder ends at the same point.
+void Browser::Impl::checkSnapshot()
+{
+    if (!_running || _disconnected || _resyncing || !_slots.empty() || !_queued.empty()) return;
+    if (_browses.empty() && !_allTypes) return;
+    if (_allTypes && !_typesBrowsed) return;
+    for (const auto& b : _browses)
+        if (!b.second.browsed) return;
+
+    finishResync();
+    if (_snapshotDone) return;
+
+    _snapshotDone = true;
+    _parent->notifySnapshotComplete();
+}
+
+//---------------------------------------------------------------------
+//--- Restarts of mDNSResponder
+//---------------------------------------------------------------------
+
+bool Browser::Impl::owns(Id id) const
+{
+    if (!id) return false;
+    if (id == _typeBrowserId || _monitorIds.count(id)) return true;
+    for (const auto& b : _browses)
+        if (b.second.id == id) return true;
+    return false;
+}
+
+// The daemon went away and took all service refs with it. The services and
+// types found so far stay, as stale, until the browses are back.
+void Browser::Impl::disconnect()
+{
+    if (_disconnected) return;
+    _disconnected = true;
+    stopResolves();
+
+    for (const auto& m : _monitors)
+        for (auto ref : {m.second.resolver, m.second.address})
+            context().release(ref);
+    _monitors.clear();
+    _monitorIds.clear();
+
+    stopBrowses();
+    for (const auto& s : _services)
+        _stale.insert(s.first);
+    for (const auto& b : _browses)
+        if (b.second.discovered) _staleTypes.insert(b.first);
+    _typeSightings.clear();
+
+    context().lost();
+}
+
+// The context saw the daemon again. If it went away once more meanwhile, the
+// context is asked to keep watching.
+void Browser::Impl::reconnect()
+{
+    if (!_disconnected) return;
+
+    auto err = _allTypes ? startTypeBrowse() : DNSServiceErrorType(kDNSServiceErr_NoError);
+    for (auto b = _browses.begin(); b != _browses.end() && err == kDNSServiceErr_NoError; ++b)
+        err = startBrowse(b->first, b->second);
+
+    if (err != kDNSServiceErr_NoError) { stopBrowses(); context().lost(); return; }
+    _disconnected = false;
+    checkSnapshot();
+}
+
+// Removes what didn't come back after a restart of the daemon
+void Browser::Impl::finishResync()
+{
+    auto stale      = std::set<std::string>();
+    auto staleTypes = std::set<std::string>();
+    stale.swap(_stale);
+    staleTypes.swap(_staleTypes);
+
+    _resyncing = true;
+    for (const auto& type : staleTypes)
+    {
+        auto browse = _browses.find(type);
+        if (browse != _browses.end() && browse->second.discovered)
+            dropType(type);
+        _parent->notifyTypeRemoved(type);
+    }
+    for (const auto& k : stale)
+        drop(k);
+    _resyncing = false;
+}
+
+//---------------------------------------------------------------------
+
+std::shared_future<ServicePtr> Browser::Impl::request(ServicePtr s)
+{
+    auto reactor = context().lock();
+    std::lock_guard<std::recursive_mutex> lock(_mutex);
+
+    auto key = serviceKey(*s);
+    auto it  = _services.find(key);
+    if (it == _services.end() || it->second != s) { return lookupReady(nullptr); }
+    if (!s->host.empty())
+    {
+        if (_monitored.contains(key)) monitor(s);
+        return lookupReady(s);
+    }
+
+    auto first  = false;
+    auto result = _parent->lookupRequest(s, first);
+    if (first)
+        resolve(s);
+    return result;
 }
 
 
@@ -212,135 +947,489 @@ void Browser::Impl::stopResolve(bool all)
 //--- DNSSD Callbacks
 //---------------------------------------------------------------------
 
-void DNSSD_API Browser::Impl::onBrowseCallback(DNSServiceRef, DNSServiceFlags flags,	uint32_t interfaceIndex, DNSServiceErrorType err,
+void DNSSD_API Browser::Impl::onBrowseCallback(DNSServiceRef sdRef, DNSServiceFlags flags,	uint32_t interfaceIndex, DNSServiceErrorType err,
                               const char *name, const char *type, const char *domain, void *userdata)
 {
 	auto* THIS = static_cast<Browser::Impl*>(userdata);
-    auto n = std::string(name);
-    auto t = std::string(type);
-    auto d = std::string(domain);
-    THIS->_queue.push([=]
+    auto  id   = THIS->context().id(sdRef);
+    if (err != kDNSServiceErr_NoError) { THIS->post(Event::BROWSE_FAILURE, id, err); return; }
+
+    auto nl = std::strlen(name);
+    auto tl = std::strlen(type);
+    auto dl = std::strlen(domain);
+    THIS->dispatch(nl + tl + dl, [&] (Event& e, Queue::Arena& arena)
     {
-	    if (err != kDNSServiceErr_NoError)  { THIS->stop(); THIS->error(ZC_BROWSER_FAILED); }
-        else                                { THIS->browseCallback(flags, interfaceIndex, n, t, d); }
-    });
+        e.kind      = Event::BROWSE;
+        e.id        = id;
+        e.flags     = flags;
+        e.interface = interfaceIndex;
+        e.name      = arena.copy(name,   nl);
+        e.type      = arena.copy(type,   tl);
+        e.domain    = arena.copy(domain, dl);
+    }, flags);
 }
 
-void Browser::Impl::browseCallback(DNSServiceFlags flags, uint32_t interface,
-                                    std::string name, std::string type, std::string domain)
+void Browser::Impl::browseCallback(const Event& e)
 {
-    auto key   = name + std::to_string(interface);
+    if (_typeBrowserId && e.id == _typeBrowserId) { typeCallback(e); return; }
+
+    // Replies of a type removed meanwhile may still have been queued
+    auto browse = _browses.begin();
+    while (browse != _browses.end() && browse->second.id != e.id) ++browse;
+    if (browse == _browses.end()) return;
+
+    browse->second.regtype = e.type.str();
+    browse->second.pending = (e.flags & kDNSServiceFlagsMoreComing) != 0;
+    if (!browse->second.pending)
+        browse->second.browsed = true;
+
+    auto key   = serviceKey(e.name.str(), e.type.str(), e.interface);
     auto isNew = _services.find(key) == _services.end();
-    if (flags & kDNSServiceFlagsAdd)
+    if (e.flags & kDNSServiceFlagsAdd)
     {
-        if (isNew)
+        // Found again after a restart of the daemon, kept as it was
+        if (_stale.erase(key) && _monitored.contains(key))
+            monitor(_services[key]);
+
+        if (isNew && !_slots.count(key) && !_queued.count(key))
         {
             auto zcs = std::make_shared<Service>();
-            zcs->name = name;
-            zcs->type = type;
-            zcs->domain = domain;
-            zcs->interface = interface;
-            _work.push_back(zcs);
-            resolve();
+            zcs->name = e.name.str();
+            zcs->type = e.type.str();
+            zcs->domain = e.domain.str();
+            zcs->interface = e.interface;
+            zcs->protocol = PROTOCOL_UNSPEC;
+            zcs->port = 0;
+
+            // Reported unresolved, resolved once resolve() asks for it
+            if (_resolveOnDemand) {
+                _services[key] = zcs;
+                serviceAdded(zcs);
+            }
+            else
+                resolve(zcs);
+        }
+    }
+    else
+        drop(key);
+
+    checkSnapshot();
+}
+
+// Replies to ALL_TYPES carry the first label of a type as name and the
+// second one with the domain as type: "_http", "_tcp.local."
+void Browser::Impl::typeCallback(const Event& e)
+{
+    _typesPending = (e.flags & kDNSServiceFlagsMoreComing) != 0;
+    if (!_typesPending)
+        _typesBrowsed = true;
+
+    auto regtype = e.type.str();
+    auto type    = e.name.str() + '.' + regtype.substr(0, regtype.find('.'));
+    if (e.flags & kDNSServiceFlagsAdd)
+    {
+        if (_typeSightings[type]++ == 0)
+        {
+            auto known = _staleTypes.erase(type) != 0;
+            addType(type, true);
+            if (!known) _parent->notifyTypeAdded(type);
         }
     }
-    else if (!isNew)
+    else
     {
-        serviceRemoved(_services[key]);
-        _services.erase(key);
+        auto it = _typeSightings.find(type);
+        if (it != _typeSightings.end() && --it->second == 0)
+        {
+            _typeSightings.erase(it);
+
+            auto browse = _browses.find(type);
+            if (browse != _browses.end() && browse->second.discovered)
+                dropType(type);
+            _parent->notifyTypeRemoved(type);
+        }
     }
+    checkSnapshot();
 }
 
 //---------------------------------------------------------------------
 
-void DNSSD_API Browser::Impl::onResolverCallback(DNSServiceRef, DNSServiceFlags, uint32_t interfaceIndex, DNSServiceErrorType err,
-                                const char*, const char* hostName, uint16_t port, uint16_t, const char*, void* userdata)
+void DNSSD_API Browser::Impl::onResolverCallback(DNSServiceRef sdRef, DNSServiceFlags flags, uint32_t interfaceIndex, DNSServiceErrorType err,
+                                const char*, const char* hostName, uint16_t port, uint16_t txtLen, const char* txtRecord, void* userdata)
 {
 	auto* THIS = static_cast<Browser::Impl*>(userdata);
-    auto h = std::string(hostName);
-    THIS->_queue.push([=]
+    auto  id   = THIS->context().id(sdRef);
+    if (err != kDNSServiceErr_NoError) { THIS->post(Event::RESOLVE_FAILURE, id, err); return; }
+
+    // A TXT record too large for the queue fails the resolve, its slot is freed
+    auto hl = std::strlen(hostName);
+    auto queued = THIS->dispatch(hl + txtLen, [&] (Event& e, Queue::Arena& arena)
     {
-	    if (err != kDNSServiceErr_NoError) { THIS->stopResolve(); }
-        else                               { THIS->resolverCallback(interfaceIndex, h, port); }
-    });
+        e.kind      = Event::RESOLVED;
+        e.id        = id;
+        e.interface = interfaceIndex;
+        e.port      = port;
+        e.host      = arena.copy(hostName, hl);
+        e.txt       = arena.copy(txtRecord, txtLen);
+    }, flags);
+    if (!queued) THIS->post(Event::RESOLVE_FAILURE, id, kDNSServiceErr_NoMemory);
 }
 
-void Browser::Impl::resolverCallback(uint32_t interfaceIndex, std::string hostName, uint16_t port)
+void Browser::Impl::resolverCallback(const Event& e, const std::string& key)
 {
-    auto service = _work.front();
+    auto& slot   = _slots[key];
+    auto service = slot.service;
 	// service->port = qFromBigEndian<uint16_t>(port);
-	service->port = port;
+	service->port = e.port;
+    service->host = e.host.str();
+    service->txt  = TxtRecord(e.txt.view());
+
+    // The resolve is done, the address query takes its place in the slot
+    _slotIds.erase(slot.id);
+    context().release(slot.ref);
+    auto err = run(slot.ref, slot.id, Event::RESOLVE_FAILURE, [&] (DNSServiceRef* ref, DNSServiceFlags flags)
+    {
+        return DNSServiceGetAddrInfo(ref, flags | kDNSServiceFlagsForceMulticast | kDNSServiceFlagsTimeout | kDNSServiceFlagsReturnIntermediates,
+                                     e.interface, convert::getDNSServiceProtocol(_protocol), service->host.c_str(),
+                                     (DNSServiceGetAddrInfoReply) Browser::Impl::onAddressCallback, this);
+    });
 
-	auto err = DNSServiceGetAddrInfo(&_resolver, kDNSServiceFlagsForceMulticast, interfaceIndex, kDNSServiceProtocol_IPv4, hostName.c_str(),
-                                (DNSServiceGetAddrInfoReply) Browser::Impl::onAddressCallback, this);
+    if (err != kDNSServiceErr_NoError) { finishResolve(key); return; }
+    _slotIds[slot.id] = key;
+}
 
-	if (err != kDNSServiceErr_NoError) {
-        stopResolve();
-        return;
-    }
+//---------------------------------------------------------------------
+
+void DNSSD_API Browser::Impl::onAddressCallback(DNSServiceRef sdRef, DNSServiceFlags flags, uint32_t interface, DNSServiceErrorType err, const char*,
+		                    const struct sockaddr* address, uint32_t, void* userdata)
+{
+	auto* THIS = static_cast<Browser::Impl*>(userdata);
+    auto  id   = THIS->context().id(sdRef);
+
+    // A negative answer tells that the host has no address of that protocol
+    auto negative = err == kDNSServiceErr_NoSuchRecord && address;
+    if (err != kDNSServiceErr_NoError && !negative) { THIS->post(Event::RESOLVE_FAILURE, id, err); return; }
 
-    std::thread t([this]()
+    THIS->dispatch(0, [&] (Event& e, Queue::Arena&)
     {
-        auto err = DNSServiceProcessResult(_resolver);
-        if (err != kDNSServiceErr_NoError)
+        e.kind      = Event::ADDRESS;
+        e.id        = id;
+        e.flags     = flags;
+        e.error     = err;
+        e.interface = interface;
+
+        auto p = convert::getProtokol(address);
+        if      (p == PROTOCOL_IPv4) e.address.v4 = *reinterpret_cast<const struct sockaddr_in*>(address);
+        else if (p == PROTOCOL_IPv6) e.address.v6 = *reinterpret_cast<const struct sockaddr_in6*>(address);
+    }, flags);
+}
+
+// Collects the addresses of every protocol asked for. Replies come in bursts,
+// the last one without MoreComing, or drained() if that one was for another
+// operation on the shared connection. A burst which leaves a protocol without
+// an answer yet is reported already, the addresses still to come follow as
+// serviceUpdated. The slot is freed once every protocol answered, negative
+// answers included, or when the query times out.
+void Browser::Impl::addressCallback(const Event& e, const std::string& key)
+{
+    auto& slot     = _slots[key];
+    auto  protocol = convert::getProtokol(&e.address.sa);
+    if (protocol != PROTOCOL_UNSPEC)
+    {
+        slot.answered |= 1u << protocol;
+
+        auto list = std::vector<std::string>();
+        for (const auto& a : slot.service->addresses)
+            if (a.protocol == protocol) list.push_back(a.address);
+
+        // Negative answers carry no address to add or remove
+        auto address = convert::getAddress(&e.address.sa);
+        auto it      = std::find(list.begin(), list.end(), address);
+        auto add     = (e.flags & kDNSServiceFlagsAdd) != 0;
+        if (e.error == kDNSServiceErr_NoError && add != (it != list.end()))
         {
-            _queue.push([this]{ stopResolve(); });
+            if (add) list.push_back(address);
+            else     list.erase(it);
+            Browser::setAddresses(*slot.service, protocol, list);
+            slot.changed = true;
         }
-    });
-    t.detach();
+    }
+    slot.pending = (e.flags & kDNSServiceFlagsMoreComing) != 0;
+    if (!slot.pending) addressesDone(key);
+}
+
+// The end of a burst of address replies
+void Browser::Impl::addressesDone(const std::string& key)
+{
+    auto& slot     = _slots[key];
+    auto  wanted   = (_protocol == PROTOCOL_UNSPEC) ? 3u : 1u << _protocol;
+    auto  complete = (slot.answered & wanted) == wanted;
+    if (slot.changed) resolved(slot);
+    if (complete)     finishResolve(key);
+}
+
+// The socket had no more replies. Bursts still waiting for their end got
+// their last reply already, it went to another operation. Handlers may
+// remove slots, they are looked up again.
+void Browser::Impl::drained()
+{
+    for (auto& b : _browses)
+        if (b.second.pending) { b.second.pending = false; b.second.browsed = true; }
+    if (_typesPending) { _typesPending = false; _typesBrowsed = true; }
+
+    auto pending = std::vector<std::string>();
+    for (const auto& s : _slots)
+        if (s.second.pending) pending.push_back(s.first);
+
+    for (const auto& key : pending)
+    {
+        auto it = _slots.find(key);
+        if (it == _slots.end() || !it->second.pending) continue;
+
+        it->second.pending = false;
+        addressesDone(key);
+    }
+    checkSnapshot();
 }
 
+// A browse without any reply by now counts as complete. One which replied
+// completes at the end of its burst.
+void Browser::Impl::quiet(Id id)
+{
+    if (_typeBrowserId && id == _typeBrowserId && !_typesBrowsed && !_typesPending)
+        _typesBrowsed = true;
+
+    for (auto& b : _browses)
+        if (b.second.id == id && !b.second.browsed && !b.second.pending) b.second.browsed = true;
+
+    checkSnapshot();
+}
+
+// Reports the service with the addresses collected so far. Handlers may
+// remove the slot, it isn't touched after emitting.
+void Browser::Impl::resolved(Slot& slot)
+{
+    auto service = slot.service;
+    auto first   = !slot.reported;
+    slot.changed  = false;
+    slot.reported = true;
+
+    auto key = serviceKey(*service);
+    if (_services.find(key) == _services.end()) {
+        _services[key] = service;
+        serviceAdded(service);
+    }
+    else
+        serviceUpdated(service);
+
+    if (!first) return;
+    _parent->lookupDone(service.get(), service);
+    if (_monitored.enabled()) monitor(service);
+}
+
+//---------------------------------------------------------------------
+//--- Monitoring
 //---------------------------------------------------------------------
 
-void DNSSD_API Browser::Impl::onAddressCallback(DNSServiceRef,DNSServiceFlags flags, uint32_t interface, DNSServiceErrorType err, const char*,
-		                    const struct sockaddr* address, uint32_t, void* userdata)
+// Keeps a resolve without timeout and an address query running for the
+// service, or marks it as used if it is monitored already. Beyond the cap the
+// least recently used service is demoted to its one-shot result.
+void Browser::Impl::monitor(const ServicePtr& service)
 {
-	auto* THIS = static_cast<Browser::Impl*>(userdata);
+    auto key = serviceKey(*service);
+    if (!_monitors.count(key))
+    {
+        auto m    = Monitor();
+        m.service = service;
+        auto err  = run(m.resolver, m.resolverId, Event::MONITOR_FAILURE, [&] (DNSServiceRef* ref, DNSServiceFlags flags)
+        {
+            return DNSServiceResolve(ref, flags, service->interface, service->name.c_str(), service->type.c_str(),
+                                     service->domain.c_str(), (DNSServiceResolveReply) Browser::Impl::onMonitorResolved, this);
+        });
+        if (err != kDNSServiceErr_NoError) return;
+
+        _monitorIds[m.resolverId] = key;
+        watchAddress(m);
+        _monitors[key] = m;
+    }
 
-    auto p = convert::getProtokol(address);
-    auto a = convert::getAddress(address);
+    auto demoted = std::string();
+    if (_monitored.touch(key, demoted))
+        unmonitor(demoted);
+}
 
-    THIS->_queue.push([=]
+void Browser::Impl::unmonitor(const std::string& key)
+{
+    _monitored.erase(key);
+
+    auto it = _monitors.find(key);
+    if (it == _monitors.end()) return;
+
+    auto& m = it->second;
+    _monitorIds.erase(m.resolverId);
+    _monitorIds.erase(m.addressId);
+    context().release(m.resolver);
+    context().release(m.address);
+    _monitors.erase(it);
+}
+
+// (Re)starts the address query for the current host of the service
+void Browser::Impl::watchAddress(Monitor& m)
+{
+    if (m.address)
     {
-	    if (err != kDNSServiceErr_NoError) { THIS->stopResolve(); }
-        else                               { THIS->addressCallback(flags, interface, a, p); }
+        _monitorIds.erase(m.addressId);
+        context().release(m.address);
+        m.address   = nullptr;
+        m.addressId = 0;
+    }
+
+    const auto& s = *m.service;
+    auto err = run(m.address, m.addressId, Event::MONITOR_FAILURE, [&] (DNSServiceRef* ref, DNSServiceFlags flags)
+    {
+        return DNSServiceGetAddrInfo(ref, flags | kDNSServiceFlagsForceMulticast, s.interface, convert::getDNSServiceProtocol(_protocol),
+                                     s.host.c_str(), (DNSServiceGetAddrInfoReply) Browser::Impl::onMonitorAddress, this);
     });
+    if (err != kDNSServiceErr_NoError) return;
+
+    _monitorIds[m.addressId] = _monitorIds[m.resolverId];
 }
 
-void Browser::Impl::addressCallback(DNSServiceFlags flags, uint32_t interfaceIndex, std::string address, Protocol protokol)
+// Starts an operation on the connection of the context. Its failure is
+// posted with the given kind, the reactor serves it until then.
+DNSServiceErrorType Browser::Impl::run(DNSServiceRef& ref, Id& id, Event::Kind failure, const Context::Impl::Call& call)
 {
-    if ((flags & kDNSServiceFlagsAdd) != 0)
+    auto err = context().start(ref, call, [this, failure] (DNSServiceRef r, DNSServiceErrorType err)
     {
-        auto service = _work.front();
+        post(failure, context().id(r), err);
+    });
+    id = ref ? context().id(ref) : 0;
+    return err;
+}
 
-        service->protocol = protokol;
-        service->address  = address;
+Browser::Impl::Monitor* Browser::Impl::findMonitor(Id id)
+{
+    // Replies of deallocated refs may still have been queued
+    auto it = _monitorIds.find(id);
+    if (it == _monitorIds.end()) return nullptr;
 
-        auto key   = service->name + std::to_string(interfaceIndex);
-        auto isNew = _services.find(key) == _services.end();
+    auto m = _monitors.find(it->second);
+    return m == _monitors.end() ? nullptr : &m->second;
+}
 
-        if (isNew) {
-            _services[key] = service;
-            serviceAdded(service);
-        }
-        else
-            serviceUpdated(service);
+//---------------------------------------------------------------------
+
+void DNSSD_API Browser::Impl::onMonitorResolved(DNSServiceRef sdRef, DNSServiceFlags flags, uint32_t interfaceIndex, DNSServiceErrorType err,
+                                const char*, const char* hostName, uint16_t port, uint16_t txtLen, const char* txtRecord, void* userdata)
+{
+	auto* THIS = static_cast<Browser::Impl*>(userdata);
+    auto  id   = THIS->context().id(sdRef);
+    if (err != kDNSServiceErr_NoError) { THIS->post(Event::MONITOR_FAILURE, id, err); return; }
+
+    auto hl = std::strlen(hostName);
+    THIS->dispatch(hl + txtLen, [&] (Event& e, Queue::Arena& arena)
+    {
+        e.kind      = Event::MONITOR_RESOLVED;
+        e.id        = id;
+        e.interface = interfaceIndex;
+        e.port      = port;
+        e.host      = arena.copy(hostName, hl);
+        e.txt       = arena.copy(txtRecord, txtLen);
+    }, flags);
+}
+
+void Browser::Impl::monitorResolved(const Event& e)
+{
+    auto* m = findMonitor(e.id);
+    if (!m || m->resolverId != e.id) return;
+
+    auto& s = *m->service;
+    auto txt = TxtRecord(e.txt.view());
+    if (s.port == e.port && s.host == e.host.str() && s.txt == txt) return;
+
+    // The addresses of the old host no longer apply
+    if (s.host != e.host.str())
+    {
+        s.host = e.host.str();
+        Browser::setAddresses(s, PROTOCOL_IPv4, {});
+        Browser::setAddresses(s, PROTOCOL_IPv6, {});
+        watchAddress(*m);
     }
+    s.port = e.port;
+    s.txt  = std::move(txt);
+
+    auto service = m->service;
+    monitor(service);
+    serviceUpdated(service);
+}
+
+void DNSSD_API Browser::Impl::onMonitorAddress(DNSServiceRef sdRef, DNSServiceFlags flags, uint32_t interface, DNSServiceErrorType err, const char*,
+		                    const struct sockaddr* address, uint32_t, void* userdata)
+{
+	auto* THIS = static_cast<Browser::Impl*>(userdata);
+    auto  id   = THIS->context().id(sdRef);
+    if (err != kDNSServiceErr_NoError) { THIS->post(Event::MONITOR_FAILURE, id, err); return; }
 
-    stopResolve();
+    THIS->dispatch(0, [&] (Event& e, Queue::Arena&)
+    {
+        e.kind      = Event::MONITOR_ADDRESS;
+        e.id        = id;
+        e.flags     = flags;
+        e.interface = interface;
+
+        auto p = convert::getProtokol(address);
+        if      (p == PROTOCOL_IPv4) e.address.v4 = *reinterpret_cast<const struct sockaddr_in*>(address);
+        else if (p == PROTOCOL_IPv6) e.address.v6 = *reinterpret_cast<const struct sockaddr_in6*>(address);
+    }, flags);
+}
+
+// Adds or removes one address, emits serviceUpdated if that changed the list
+void Browser::Impl::monitorAddress(const Event& e)
+{
+    auto* m = findMonitor(e.id);
+    if (!m || m->addressId != e.id) return;
+
+    auto protocol = convert::getProtokol(&e.address.sa);
+    auto address  = convert::getAddress(&e.address.sa);
+    if (protocol == PROTOCOL_UNSPEC) return;
+
+    auto list = std::vector<std::string>();
+    for (const auto& a : m->service->addresses)
+        if (a.protocol == protocol) list.push_back(a.address);
+
+    auto it = std::find(list.begin(), list.end(), address);
+    auto add = (e.flags & kDNSServiceFlagsAdd) != 0;
+    if      (add && it == list.end())  { list.push_back(address); }
+    else if (!add && it != list.end()) { list.erase(it);          }
+    else                               { return;                  }
+
+    auto service = m->service;
+    Browser::setAddresses(*service, protocol, list);
+    monitor(service);
+    serviceUpdated(service);
 }
 
 //---------------------------------------------------------------------
 //--- Browser
 //---------------------------------------------------------------------
 
-Browser::Browser() 	{ _impl = std::make_unique<Impl>(this); }
+Browser::Browser()                              : Browser(Options()) {}
+Browser::Browser(const Options& options)        { init(options); _impl = std::make_unique<Impl>(this, options); }
 Browser::~Browser() = default;
 
 //---------------------------------------------------------------------
 
-void Browser::poll()                            { _impl->poll(); }
-void Browser::start(const std::string& type)	{ _impl->start(type); }
-void Browser::stop() 							{ _impl->stop(); }
+void Browser::poll()                                             { _impl->poll(); }
+void Browser::pollBatch(Batch& batch)                            { _impl->poll(&batch); }
+void Browser::poll(std::chrono::milliseconds timeout)            { _impl->poll(flushTimeout(timeout)); }
+std::vector<ServicePtr> Browser::services() const                { return _impl->services(); }
+Browser::Statistics Browser::queueStatistics() const             { return _impl->statistics(); }
+int Browser::nativeHandle() const                                { return _impl->nativeHandle(); }
+Connection Browser::subscribe(const ChangeHandler& h)            { return _impl->subscribe(h); }
+std::shared_future<ServicePtr> Browser::resolve(ServicePtr s)    { return _impl->request(s); }
+void Browser::start(const std::string& type, Protocol protocol)  { _impl->start(type, protocol); }
+void Browser::stop()                                             { _impl->stop(); }
+void Browser::addType(const std::string& type)                   { _impl->addType(type); }
+void Browser::removeType(const std::string& type)                { _impl->removeType(type); }
+std::vector<std::string> Browser::types() const                  { return _impl->types(); }
 
 }
@@ -0,0 +1,35 @@
+#include "Context.h"
+
+#if defined(__APPLE__) || defined(_WIN32)
+    #include "Context_bonjour.h"
+#else
+    #include "Context_avahiclient.h"
+#endif
+
+#include <mutex>
+
+namespace zeroconf {
+
+//---------------------------------------------------------------------
+//--- Context
+//---------------------------------------------------------------------
+
+Context::Context()  : _impl(std::make_unique<Impl>()) {}
+Context::~Context() = default;
+
+std::shared_ptr<Context> Context::shared()
+{
+    static std::mutex             mutex;
+    static std::weak_ptr<Context> current;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto context = current.lock();
+    if (!context)
+    {
+        context = std::make_shared<Context>();
+        current = context;
+    }
+    return context;
+}
+
+}
@@ -0,0 +1,52 @@
+// Copyright (c) 2017  Mathias Roder (teuse@mailbox.org)
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+#include <memory>
+
+
+namespace zeroconf {
+
+//------------------------------------------------------------------------------
+
+// Connection to the zeroconf daemon shared by Browsers and Publishers. With
+// Avahi it owns the one poll thread and client (a D-Bus connection) all of them
+// run on, instead of one each. Pass it in their Options, those created without
+// one share Context::shared().
+
+class Context
+{
+public:
+
+	Context();
+	~Context();
+
+    Context(const Context&)            = delete;
+    Context& operator=(const Context&) = delete;
+
+    // The context of the Browsers and Publishers created without one. Made on
+    // first use and released together with the last of them.
+    static std::shared_ptr<Context> shared();
+
+    class Impl;
+
+private:
+
+    friend class Browser;
+    friend class Publisher;
+
+    std::unique_ptr<Impl> _impl;
+};
+
+}
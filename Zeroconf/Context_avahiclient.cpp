@@ -0,0 +1,73 @@
+#include "Context_avahiclient.h"
+
+#include <avahi-common/error.h>
+
+#include <iostream>
+
+namespace zeroconf {
+
+//---------------------------------------------------------------------
+
+Context::Impl::Impl()
+{
+    _poll.reset(avahi_threaded_poll_new());
+    if (!_poll) { std::cout << "Context: Failed to create poll" << std::endl; return; }
+
+    connect();
+    avahi_threaded_poll_start(_poll.get());
+}
+
+// The Browsers and Publishers have freed their avahi objects by now, they
+// keep the context alive
+Context::Impl::~Impl()
+{
+    if (_poll) avahi_threaded_poll_stop(_poll.get());
+    _client.reset();
+}
+
+//---------------------------------------------------------------------
+
+// Replaces the client. Avahi reports the state of a new client before
+// avahi_client_new() returns, so it is taken from the client afterwards.
+void Context::Impl::connect()
+{
+    _running = false;
+
+    int ret = 0;
+    auto* client = avahi_client_new(avahi_threaded_poll_get(_poll.get()), AVAHI_CLIENT_NO_FAIL, stateCallback, this, &ret);
+    if (!client) { std::cout << "Context: Start avahi failed with error: " << avahi_strerror(ret) << std::endl; }
+
+    _client.reset(client, [] (::AvahiClient* c) { if (c) avahi_client_free(c); });
+    _running = client && avahi_client_get_state(client) == AVAHI_CLIENT_S_RUNNING;
+    _stateChanged();
+}
+
+void Context::Impl::stateCallback(avahi::Client* client, avahi::ClientState state, void* userdata)
+{
+    auto* THIS = static_cast<Context::Impl*>(userdata);
+    if (client != THIS->_client.get()) return;
+
+    avahi::CallbackScope scope;
+    switch (state)
+    {
+        case AVAHI_CLIENT_S_RUNNING:
+        {
+            THIS->_running = true;
+            THIS->_stateChanged();
+            break;
+        }
+        case AVAHI_CLIENT_FAILURE:
+        {
+            THIS->_running = false;
+            THIS->_stateChanged();
+
+            // The daemon went away, a new client waits for it to come back
+            if (avahi_client_errno(client) == AVAHI_ERR_DISCONNECTED)
+                THIS->connect();
+            break;
+        }
+        default: { break; }
+    }
+}
+
+}
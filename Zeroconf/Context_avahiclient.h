@@ -0,0 +1,258 @@
+// Copyright (c) 2017  Mathias Roder (teuse@mailbox.org)
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+#include <Zeroconf/Context.h>
+#include <Zeroconf/Signal.h>
+
+#ifdef ZEROCONF_AVAHI_CORE
+    #include <avahi-core/core.h>
+    #include <avahi-core/lookup.h>
+    #include <avahi-core/publish.h>
+#else
+    #include <avahi-client/client.h>
+    #include <avahi-client/lookup.h>
+    #include <avahi-client/publish.h>
+#endif
+#include <avahi-common/thread-watch.h>
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+
+namespace zeroconf {
+
+//------------------------------------------------------------------------------
+
+// The calls of avahi-client, which talks to avahi-daemon over D-Bus, and their
+// counterparts in avahi-core, which runs the mDNS stack in this process. Both
+// take the same arguments, the "client" is an AvahiServer with avahi-core.
+// Chosen at configure time with ZEROCONF_AVAHI_CORE.
+
+namespace avahi
+{
+    // Tells objects apart where their pointers can't: the memory of a freed
+    // object is reused by the next one. Ids aren't, 0 stands for none. The
+    // new*() calls below give one to every object, destroy() takes it back.
+    // Shared by all contexts, so it has a lock of its own.
+    using Id = uint64_t;
+
+    struct Ids
+    {
+        std::mutex                          mutex;
+        std::unordered_map<const void*, Id> ids;
+        Id                                  last = 0;
+    };
+
+    inline Ids& ids()
+    {
+        static Ids instance;
+        return instance;
+    }
+
+    template <typename T>
+    T* track(T* object)
+    {
+        if (!object) return object;
+
+        auto& i = ids();
+        std::lock_guard<std::mutex> lock(i.mutex);
+        i.ids[object] = ++i.last;
+        return object;
+    }
+
+    inline void untrack(const void* object)
+    {
+        auto& i = ids();
+        std::lock_guard<std::mutex> lock(i.mutex);
+        i.ids.erase(object);
+    }
+
+    // The id of a live object, in its callbacks for instance
+    inline Id id(const void* object)
+    {
+        if (!object) return 0;
+
+        auto& i = ids();
+        std::lock_guard<std::mutex> lock(i.mutex);
+        auto it = i.ids.find(object);
+        return it == i.ids.end() ? 0 : it->second;
+    }
+
+#ifdef ZEROCONF_AVAHI_CORE
+    using Client          = ::AvahiServer;
+    using ClientState     = ::AvahiServerState;
+    using ServiceBrowser  = ::AvahiSServiceBrowser;
+    using TypeBrowser     = ::AvahiSServiceTypeBrowser;
+    using ServiceResolver = ::AvahiSServiceResolver;
+    using EntryGroup      = ::AvahiSEntryGroup;
+
+    using ServiceBrowserCallback  = ::AvahiSServiceBrowserCallback;
+    using TypeBrowserCallback     = ::AvahiSServiceTypeBrowserCallback;
+    using ServiceResolverCallback = ::AvahiSServiceResolverCallback;
+
+    inline ServiceBrowser* newServiceBrowser(Client* c, AvahiIfIndex i, AvahiProtocol p, const char* type, const char* domain,
+                                             AvahiLookupFlags f, ServiceBrowserCallback cb, void* userdata)
+    { return track(avahi_s_service_browser_new(c, i, p, type, domain, f, cb, userdata)); }
+
+    inline TypeBrowser* newTypeBrowser(Client* c, AvahiIfIndex i, AvahiProtocol p, const char* domain,
+                                       AvahiLookupFlags f, TypeBrowserCallback cb, void* userdata)
+    { return track(avahi_s_service_type_browser_new(c, i, p, domain, f, cb, userdata)); }
+
+    inline ServiceResolver* newServiceResolver(Client* c, AvahiIfIndex i, AvahiProtocol p, const char* name, const char* type,
+                                               const char* domain, AvahiProtocol aprotocol, AvahiLookupFlags f,
+                                               ServiceResolverCallback cb, void* userdata)
+    { return track(avahi_s_service_resolver_new(c, i, p, name, type, domain, aprotocol, f, cb, userdata)); }
+
+    // Entry group callbacks of avahi-core get the server first, F doesn't
+    template <void (*F)(EntryGroup*, AvahiEntryGroupState, void*)>
+    EntryGroup* newEntryGroup(Client* c, void* userdata)
+    {
+        auto callback = [] (AvahiServer*, EntryGroup* g, AvahiEntryGroupState state, void* u) { F(g, state, u); };
+        return track(avahi_s_entry_group_new(c, callback, userdata));
+    }
+
+    inline int addService(Client* c, EntryGroup* g, AvahiIfIndex i, AvahiProtocol p, AvahiPublishFlags f,
+                          const char* name, const char* type, const char* domain, const char* host, uint16_t port)
+    { return avahi_server_add_service(c, g, i, p, f, name, type, domain, host, port, NULL); }
+
+    inline int  commit(EntryGroup* g)          { return avahi_s_entry_group_commit(g);   }
+    inline bool isEmpty(EntryGroup* g)         { return avahi_s_entry_group_is_empty(g); }
+    inline int  lastError(Client* c)           { return avahi_server_errno(c);           }
+
+    inline void destroy(ServiceBrowser* b)     { untrack(b); avahi_s_service_browser_free(b);       }
+    inline void destroy(TypeBrowser* b)        { untrack(b); avahi_s_service_type_browser_free(b);  }
+    inline void destroy(ServiceResolver* r)    { untrack(r); avahi_s_service_resolver_free(r);      }
+    inline void destroy(EntryGroup* g)         { untrack(g); avahi_s_entry_group_free(g);           }
+#else
+    using Client          = ::AvahiClient;
+    using ClientState     = ::AvahiClientState;
+    using ServiceBrowser  = ::AvahiServiceBrowser;
+    using TypeBrowser     = ::AvahiServiceTypeBrowser;
+    using ServiceResolver = ::AvahiServiceResolver;
+    using EntryGroup      = ::AvahiEntryGroup;
+
+    using ServiceBrowserCallback  = ::AvahiServiceBrowserCallback;
+    using TypeBrowserCallback     = ::AvahiServiceTypeBrowserCallback;
+    using ServiceResolverCallback = ::AvahiServiceResolverCallback;
+
+    inline ServiceBrowser* newServiceBrowser(Client* c, AvahiIfIndex i, AvahiProtocol p, const char* type, const char* domain,
+                                             AvahiLookupFlags f, ServiceBrowserCallback cb, void* userdata)
+    { return track(avahi_service_browser_new(c, i, p, type, domain, f, cb, userdata)); }
+
+    inline TypeBrowser* newTypeBrowser(Client* c, AvahiIfIndex i, AvahiProtocol p, const char* domain,
+                                       AvahiLookupFlags f, TypeBrowserCallback cb, void* userdata)
+    { return track(avahi_service_type_browser_new(c, i, p, domain, f, cb, userdata)); }
+
+    inline ServiceResolver* newServiceResolver(Client* c, AvahiIfIndex i, AvahiProtocol p, const char* name, const char* type,
+                                               const char* domain, AvahiProtocol aprotocol, AvahiLookupFlags f,
+                                               ServiceResolverCallback cb, void* userdata)
+    { return track(avahi_service_resolver_new(c, i, p, name, type, domain, aprotocol, f, cb, userdata)); }
+
+    template <void (*F)(EntryGroup*, AvahiEntryGroupState, void*)>
+    EntryGroup* newEntryGroup(Client* c, void* userdata)
+    { return track(avahi_entry_group_new(c, F, userdata)); }
+
+    inline int addService(Client*, EntryGroup* g, AvahiIfIndex i, AvahiProtocol p, AvahiPublishFlags f,
+                          const char* name, const char* type, const char* domain, const char* host, uint16_t port)
+    { return avahi_entry_group_add_service(g, i, p, f, name, type, domain, host, port, NULL); }
+
+    inline int  commit(EntryGroup* g)          { return avahi_entry_group_commit(g);     }
+    inline bool isEmpty(EntryGroup* g)         { return avahi_entry_group_is_empty(g);   }
+    inline int  lastError(Client* c)           { return avahi_client_errno(c);           }
+
+    inline void destroy(ServiceBrowser* b)     { untrack(b); avahi_service_browser_free(b);         }
+    inline void destroy(TypeBrowser* b)        { untrack(b); avahi_service_type_browser_free(b);    }
+    inline void destroy(ServiceResolver* r)    { untrack(r); avahi_service_resolver_free(r);        }
+    inline void destroy(EntryGroup* g)         { untrack(g); avahi_entry_group_free(g);             }
+#endif
+
+    // Owns an object created by the calls above
+    template <typename T>
+    using Ptr = std::unique_ptr<T, void (*)(T*)>;
+
+    // Set while this thread holds the poll lock: avahi runs our callbacks with
+    // it held, and an outer PollLock may have taken it. Locking it again would
+    // dead lock. Shared by everything on the poll thread of a context, a
+    // handler of one Browser may stop another.
+    inline bool& pollLocked()
+    {
+        thread_local bool flag = false;
+        return flag;
+    }
+
+    struct CallbackScope
+    {
+        CallbackScope()  : _outer(pollLocked()) { pollLocked() = true;   }
+        ~CallbackScope()                        { pollLocked() = _outer; }
+
+        bool _outer;
+    };
+
+    // Avahi objects may only be touched from outside the poll thread while it
+    // is locked. Nested locks are no-ops.
+    struct PollLock
+    {
+        PollLock(AvahiThreadedPoll* p) : _p(pollLocked() ? nullptr : p)  { if (_p) { avahi_threaded_poll_lock(_p); pollLocked() = true; } }
+        ~PollLock()                                                      { if (_p) { pollLocked() = false; avahi_threaded_poll_unlock(_p); } }
+
+        AvahiThreadedPoll* _p;
+    };
+}
+
+//------------------------------------------------------------------------------
+
+// The client is created with AVAHI_CLIENT_NO_FAIL: it waits for a daemon
+// which isn't running yet, and is replaced by a new one when the daemon goes
+// away. Browsers and Publishers follow it on stateChanged. With avahi-core
+// the client is the in-process server, which lives as long as the context.
+
+class Context::Impl
+{
+    using AvahiPollPtr = std::unique_ptr<AvahiThreadedPoll, decltype(&avahi_threaded_poll_free)>;
+
+public:
+
+    // Objects created on a client stay valid as long as they hold it, also
+    // after it was replaced. Released with the poll lock held.
+    using ClientPtr = std::shared_ptr<avahi::Client>;
+
+	Impl();
+	~Impl();
+
+    AvahiThreadedPoll* poll() const   { return _poll.get(); }
+
+    // The client to create objects on, nullptr while the daemon isn't
+    // reachable. Call with the poll lock held.
+    ClientPtr          client() const { return _running ? _client : nullptr; }
+
+    // Emitted on the poll thread, with the poll lock held, when the client
+    // became usable or failed
+	Connection connectStateChanged(const std::function<void()> handler)
+    { return _stateChanged.connect(handler); }
+
+private:
+
+    void connect();
+    static void stateCallback(avahi::Client* client, avahi::ClientState state, void* userdata);
+
+    AvahiPollPtr    _poll    = {nullptr, &avahi_threaded_poll_free};
+    ClientPtr       _client;
+    bool            _running = false;
+    Signal<>        _stateChanged;
+};
+
+}
@@ -0,0 +1,92 @@
+#include "Context_avahiclient.h"
+
+#include <avahi-common/alternative.h>
+#include <avahi-common/error.h>
+#include <avahi-common/malloc.h>
+
+#include <iostream>
+
+namespace zeroconf {
+
+//---------------------------------------------------------------------
+
+// avahi-core runs the mDNS stack in this process. Browses and resolves are
+// calls on the poll thread instead of D-Bus round trips to avahi-daemon, and
+// there is no daemon which could go away.
+
+Context::Impl::Impl()
+{
+    _poll.reset(avahi_threaded_poll_new());
+    if (!_poll) { std::cout << "Context: Failed to create poll" << std::endl; return; }
+
+    connect();
+    avahi_threaded_poll_start(_poll.get());
+}
+
+// The Browsers and Publishers have freed their avahi objects by now, they
+// keep the context alive
+Context::Impl::~Impl()
+{
+    if (_poll) avahi_threaded_poll_stop(_poll.get());
+    _client.reset();
+}
+
+//---------------------------------------------------------------------
+
+// Publishes the host name and addresses, services registered here must
+// resolve without a daemon too. The other host records are left out. The
+// server reports its state before avahi_server_new() returns, so it is taken
+// from the server afterwards.
+void Context::Impl::connect()
+{
+    _running = false;
+
+    AvahiServerConfig config;
+    avahi_server_config_init(&config);
+    config.publish_hinfo       = 0;
+    config.publish_workstation = 0;
+    config.publish_domain      = 0;
+
+    int ret = 0;
+    auto* server = avahi_server_new(avahi_threaded_poll_get(_poll.get()), &config, stateCallback, this, &ret);
+    avahi_server_config_free(&config);
+    if (!server) { std::cout << "Context: Start avahi-core failed with error: " << avahi_strerror(ret) << std::endl; }
+
+    _client.reset(server, [] (::AvahiServer* s) { if (s) avahi_server_free(s); });
+    _running = server && avahi_server_get_state(server) == AVAHI_SERVER_RUNNING;
+    _stateChanged();
+}
+
+void Context::Impl::stateCallback(AvahiServer* server, AvahiServerState state, void* userdata)
+{
+    auto* THIS = static_cast<Context::Impl*>(userdata);
+    if (server != THIS->_client.get()) return;
+
+    avahi::CallbackScope scope;
+    switch (state)
+    {
+        case AVAHI_SERVER_RUNNING:
+        {
+            THIS->_running = true;
+            THIS->_stateChanged();
+            break;
+        }
+        case AVAHI_SERVER_COLLISION:
+        {
+            // Another host uses our host name, continue with the next free one
+            auto* name = avahi_alternative_host_name(avahi_server_get_host_name(server));
+            avahi_server_set_host_name(server, name);
+            avahi_free(name);
+            break;
+        }
+        case AVAHI_SERVER_FAILURE:
+        {
+            THIS->_running = false;
+            THIS->_stateChanged();
+            break;
+        }
+        default: { break; }
+    }
+}
+
+}
@@ -0,0 +1,262 @@
+#include "Context_bonjour.h"
+
+#if defined(_WIN32)
+    #include <winsock2.h>
+#else
+    #include <poll.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <iterator>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace zeroconf {
+
+//---------------------------------------------------------------------
+
+namespace {
+
+    pollfd readable(int fd)
+    {
+        pollfd p = {};
+        p.fd     = fd;
+        p.events = POLLIN;
+        return p;
+    }
+
+    int wait(std::vector<pollfd>& fds, int timeout)
+    {
+#if defined(_WIN32)
+        return WSAPoll(fds.data(), ULONG(fds.size()), timeout);
+#else
+        return ::poll(fds.data(), fds.size(), timeout);
+#endif
+    }
+}
+
+//---------------------------------------------------------------------
+
+Context::Impl::Impl()
+: _reactor([this] { run(); })
+{}
+
+Context::Impl::~Impl()
+{
+    {
+        Lock lock(_mutex);
+        _quit = true;
+    }
+    _wake.notify();
+    _reactor.join();
+
+    // The operations were released by their owners
+    for (const auto& u : _users)
+        if (u.first != _connection) DNSServiceRefDeallocate(u.first);
+    if (_connection) DNSServiceRefDeallocate(_connection);
+}
+
+//---------------------------------------------------------------------
+
+DNSServiceErrorType Context::Impl::start(DNSServiceRef& ref, const Call& call, Failed failed)
+{
+    Lock lock(_mutex);
+
+    auto err = connect();
+    if (err == kDNSServiceErr_NoError)
+    {
+        ref = _connection;
+        err = call(&ref, kDNSServiceFlagsShareConnection);
+    }
+    if (err != kDNSServiceErr_NoError) { ref = nullptr; return err; }
+
+    _operations[ref] = Operation{_connection, std::move(failed), ++_lastId};
+    ++_users[_connection];
+    return err;
+}
+
+void Context::Impl::release(DNSServiceRef ref)
+{
+    Lock lock(_mutex);
+
+    auto it = _operations.find(ref);
+    if (it == _operations.end()) return;
+
+    auto connection = it->second.connection;
+    _operations.erase(it);
+    DNSServiceRefDeallocate(ref);
+
+    for (auto t = _timers.begin(); t != _timers.end();)
+        t = (t->second.ref == ref) ? _timers.erase(t) : std::next(t);
+
+    if (--_users[connection] == 0) close(connection);
+}
+
+Context::Impl::Id Context::Impl::id(DNSServiceRef ref)
+{
+    Lock lock(_mutex);
+
+    auto it = _operations.find(ref);
+    return it == _operations.end() ? 0 : it->second.id;
+}
+
+void Context::Impl::schedule(DNSServiceRef ref, std::chrono::milliseconds after, std::function<void()> handler)
+{
+    Lock lock(_mutex);
+    if (!_operations.count(ref)) return;
+
+    _timers.emplace(Clock::now() + after, Timer{ref, std::move(handler)});
+    _wake.notify();
+}
+
+void Context::Impl::lost()
+{
+    Lock lock(_mutex);
+    if (_lost) return;
+
+    _lost      = true;
+    _nextProbe = std::chrono::steady_clock::now();
+    _wake.notify();
+}
+
+void Context::Impl::disconnect(Connection& c)
+{
+    Lock lock(_mutex);
+    c.disconnect();
+}
+
+//---------------------------------------------------------------------
+
+DNSServiceErrorType Context::Impl::connect()
+{
+    if (_connection) return kDNSServiceErr_NoError;
+
+    auto err = DNSServiceCreateConnection(&_connection);
+    if (err != kDNSServiceErr_NoError) { _connection = nullptr; return err; }
+
+    _users[_connection] = 0;
+    _wake.notify();
+    return err;
+}
+
+// Closes a failed connection once its last operation is released. The current
+// one stays open for the next operations.
+void Context::Impl::close(DNSServiceRef connection)
+{
+    if (connection == _connection) return;
+
+    _users.erase(connection);
+    DNSServiceRefDeallocate(connection);
+}
+
+// Waits without the lock, so owners can start and release operations
+// meanwhile. A new connection wakes the reactor to wait for it instead.
+// Windows has no handle to wake it, there it looks again every 100 ms.
+void Context::Impl::run()
+{
+    auto fds = std::vector<pollfd>();
+    for (;;)
+    {
+        auto timeout = -1;
+        {
+            Lock lock(_mutex);
+            if (_quit) return;
+
+            fds.clear();
+            if (_connection) fds.push_back(readable(DNSServiceRefSockFD(_connection)));
+
+            auto next = Clock::time_point::max();
+            if (_lost)            next = _nextProbe;
+            if (!_timers.empty()) next = std::min(next, _timers.begin()->first);
+            if (next != Clock::time_point::max())
+            {
+                auto due = std::chrono::ceil<std::chrono::milliseconds>(next - Clock::now());
+                timeout  = int(std::max<std::chrono::milliseconds::rep>(due.count(), 0));
+            }
+        }
+
+        if (_wake.handle() >= 0)    fds.push_back(readable(_wake.handle()));
+        else if (!fds.empty())      timeout = (timeout < 0) ? 100 : std::min(timeout, 100);
+
+        if (fds.empty())  _wake.wait(std::chrono::milliseconds(timeout < 0 ? 1000 : timeout));
+        else              wait(fds, timeout);
+        _wake.reset();
+
+        Lock lock(_mutex);
+        if (_quit) return;
+        serve();
+        if (_lost && std::chrono::steady_clock::now() >= _nextProbe) probe();
+        fire();
+    }
+}
+
+// Runs the replies waiting on the connection. Whether it is readable is asked
+// again under the lock, it may have been replaced since the reactor woke up.
+// DNSServiceProcessResult handles one reply, it is called until the socket has
+// no more, then drained tells the owners the burst is over.
+void Context::Impl::serve()
+{
+    auto served = false;
+    while (_connection)
+    {
+        auto fds = std::vector<pollfd>{readable(DNSServiceRefSockFD(_connection))};
+        if (wait(fds, 0) <= 0) break;
+
+        served   = true;
+        auto err = DNSServiceProcessResult(_connection);
+        if (err != kDNSServiceErr_NoError) { fail(err); break; }
+    }
+
+    if (served) _drained();
+}
+
+// The connection broke and the operations on it with it. They stay with their
+// owners until released, the connection until the last of them is.
+void Context::Impl::fail(DNSServiceErrorType err)
+{
+    auto connection = _connection;
+    _connection     = nullptr;
+
+    auto failed = std::vector<std::pair<DNSServiceRef, Failed>>();
+    for (auto& o : _operations)
+    {
+        if (o.second.connection != connection || !o.second.failed) continue;
+        failed.emplace_back(o.first, std::move(o.second.failed));
+        o.second.failed = nullptr;
+    }
+    if (_users[connection] == 0) close(connection);
+
+    for (const auto& f : failed)
+        f.second(f.first, err);
+}
+
+// Runs the due timers one by one, a handler may release the operation of the
+// next one
+void Context::Impl::fire()
+{
+    auto now = Clock::now();
+    while (!_timers.empty() && _timers.begin()->first <= now)
+    {
+        auto handler = std::move(_timers.begin()->second.handler);
+        _timers.erase(_timers.begin());
+        handler();
+    }
+}
+
+// A new connection tells whether the daemon is there, and is kept
+void Context::Impl::probe()
+{
+    if (connect() != kDNSServiceErr_NoError)
+    {
+        _nextProbe = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+        return;
+    }
+
+    // Handlers may call lost() again
+    _lost = false;
+    _stateChanged();
+}
+
+}
@@ -0,0 +1,144 @@
+// Copyright (c) 2017  Mathias Roder (teuse@mailbox.org)
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+#include <Zeroconf/Context.h>
+#include <Zeroconf/Notifier.h>
+#include <Zeroconf/Signal.h>
+
+#include <dns_sd.h>
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+
+
+namespace zeroconf {
+
+//------------------------------------------------------------------------------
+
+// All dnssd operations of a context share one connection to mDNSResponder,
+// made with DNSServiceCreateConnection. Browses, resolves, address queries and
+// registrations are subordinate refs on it (kDNSServiceFlagsShareConnection),
+// one socket instead of one per operation. A reactor thread waits for the
+// socket and runs DNSServiceProcessResult, which dispatches each reply to the
+// callback of its operation.
+//
+// When the daemon restarts the connection fails with
+// kDNSServiceErr_ServiceNotRunning, and every operation on it with it. Their
+// owners report that with lost(). The reactor then looks for the daemon once a
+// second and emits stateChanged when it is back. New operations go to a new
+// connection, the old one is closed with the last operation released.
+//
+// kDNSServiceFlagsMoreComing is set while further replies wait on the socket,
+// whichever operation they are for. An owner batching its replies on it may
+// see the last reply of a burst go to someone else, drained tells it the burst
+// is over.
+
+class Context::Impl
+{
+public:
+	Impl();
+	~Impl();
+
+    // Held by the reactor thread while it runs dnssd callbacks and handlers.
+    // Owners take it before their own lock where they change refs, poll()
+    // included as its handlers may, the order of the reactor thread with
+    // DISPATCH_DIRECT. Recursive.
+    using Lock = std::unique_lock<std::recursive_mutex>;
+    Lock lock() { return Lock(_mutex); }
+
+    // One of the DNSService* calls, given the ref to set up and the flags to
+    // add to its own
+    using Call   = std::function<DNSServiceErrorType(DNSServiceRef*, DNSServiceFlags)>;
+    using Failed = std::function<void(DNSServiceRef, DNSServiceErrorType)>;
+
+    // Starts an operation on the shared connection, connecting first if need
+    // be. It is served until it fails, failed then runs on the reactor thread.
+    // The ref stays with the caller, nullptr if the call failed.
+    DNSServiceErrorType start(DNSServiceRef& ref, const Call& call, Failed failed);
+
+    // Stops an operation and deallocates its ref, waits for a callback running
+    void release(DNSServiceRef ref);
+
+    // Tells operations apart where their refs can't: the memory of a released
+    // ref is reused by the next one. Ids aren't, 0 stands for none. Valid
+    // while the operation runs, in its callbacks for instance.
+    using Id = uint64_t;
+    Id id(DNSServiceRef ref);
+
+    // Runs handler on the reactor thread after the given time, unless the
+    // operation is released before
+    void schedule(DNSServiceRef ref, std::chrono::milliseconds after, std::function<void()> handler);
+
+    // Starts watching for the daemon
+    void lost();
+
+    // Emitted on the reactor thread once the daemon answers again. Disconnect
+    // with disconnect(), which waits for a running handler.
+	Connection connectStateChanged(const std::function<void()> handler)
+    { Lock l(_mutex); return _stateChanged.connect(handler); }
+
+    // Emitted on the reactor thread once the replies waiting on the socket
+    // are handled. Disconnect with disconnect().
+	Connection connectDrained(const std::function<void()> handler)
+    { Lock l(_mutex); return _drained.connect(handler); }
+
+    void disconnect(Connection& c);
+
+private:
+
+    struct Operation
+    {
+        DNSServiceRef connection;
+        Failed        failed;       // empty once the connection failed
+        Id            id;
+    };
+
+    DNSServiceErrorType connect();
+    void close(DNSServiceRef connection);
+    void run();
+    void serve();
+    void fail(DNSServiceErrorType err);
+    void probe();
+    void fire();
+
+    using Clock = std::chrono::steady_clock;
+
+    struct Timer
+    {
+        DNSServiceRef         ref;
+        std::function<void()> handler;
+    };
+
+    std::recursive_mutex                _mutex;         // guards everything below
+    DNSServiceRef                       _connection = nullptr;
+    std::map<DNSServiceRef, Operation>  _operations;
+    std::map<DNSServiceRef, size_t>     _users;         // operations per connection, failed ones included
+    Id                                  _lastId = 0;
+    bool                                _lost = false;
+    bool                                _quit = false;
+    std::chrono::steady_clock::time_point _nextProbe;
+    std::multimap<Clock::time_point, Timer> _timers;    // by the time they are due
+
+    Notifier                            _wake;          // the connection changed
+    Signal<>                            _stateChanged;
+    Signal<>                            _drained;
+    std::thread                         _reactor;
+};
+
+}
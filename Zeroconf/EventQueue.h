@@ -0,0 +1,602 @@
+// Copyright (c) 2017  Mathias Roder (teuse@mailbox.org)
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+#include <Zeroconf/Notifier.h>
+#include <Zeroconf/Service.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <list>
+#include <mutex>
+#include <new>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+
+namespace zeroconf {
+
+//------------------------------------------------------------------------------
+
+// String stored in the byte arena of an EventQueue. It stays valid while the
+// event holding it is being consumed.
+
+struct Text
+{
+    const char* data = nullptr;
+    size_t      size = 0;
+
+    std::string      str() const  { return std::string(data, size); }
+    std::string_view view() const { return std::string_view(data, size); }
+};
+
+//------------------------------------------------------------------------------
+
+// Single producer / single consumer queue between the backend thread and poll().
+//
+// Events are stored in fixed size segments which are linked together when the
+// producer runs ahead of the consumer, so a burst grows the queue instead of
+// losing events. Drained segments go back to a pool and are reused by the
+// producer, so once the queue has seen its largest burst no more allocations
+// happen. A capacity of 0 means unbounded.
+//
+// Every segment carries a byte arena for the strings of its events, so events
+// can be plain structs referring to their strings through Text.
+//
+// The notifier handle becomes readable when the queue goes from empty to
+// non-empty, so a consumer can sleep in epoll/select instead of spinning poll().
+// Between hold() and publish() the producer stages its events, the consumer
+// sees them and is woken up once, when the burst is complete. A segment which
+// fills up meanwhile is published on its own.
+//
+// A bounded queue applies its Backpressure policy once capacity is reached:
+// - DROP_OLDEST takes a lock shared with the consumer, only while the consumer
+//   moves an event out, never while it runs the handler.
+// - BLOCK sleeps until the consumer took an event out. The producer is usually
+//   a daemon thread holding a lock the consumer needs for its handler, so such
+//   a consumer takes the events out with take() before it locks, and the
+//   producer doesn't wait while they are being handled. The wait is bounded by
+//   blockTimeout and the event dropped after it, for a consumer which stopped.
+// - COALESCE moves further events into an overflow list keyed by key(event),
+//   replacing the pending event with the same key. The consumer handles the
+//   overflow after the queue, in the order of the latest event per key. Only
+//   the overflow path allocates.
+// Events keep(event) is true for are never dropped, the queue takes them
+// beyond its capacity. DROP_OLDEST drops the newest event instead while the
+// oldest one is to be kept.
+
+template <typename T, size_t SegmentSize = 64, size_t ArenaSize = 16384>
+class EventQueue
+{
+    struct Segment
+    {
+        using Slot = typename std::aligned_storage<sizeof(T), alignof(T)>::type;
+
+        T* slot(size_t i) { return reinterpret_cast<T*>(&slots[i]); }
+
+        Slot                  slots[SegmentSize];
+        char                  bytes[ArenaSize];
+        size_t                used    = 0;          // arena bytes handed out, producer only
+        std::atomic<size_t>   written = {0};        // slots published by the producer
+        size_t                read    = 0;          // slots consumed, consumer or _consumer held
+        std::atomic<Segment*> next    = {nullptr};  // set by the producer once the segment is full
+        Segment*              pooled  = nullptr;    // link while the segment sits in the pool
+    };
+
+public:
+
+    // Hands out the string storage reserved for one event. A default constructed
+    // arena has no storage and hands out the strings themselves, for events which
+    // are processed before their strings go out of scope.
+    class Arena
+    {
+    public:
+        Arena() = default;
+
+        Text copy(const char* s, size_t size)
+        {
+            Text t;
+            t.data = _next ? _next : s;
+            t.size = size;
+            if (_next && size) { std::memcpy(_next, s, size); _next += size; }
+            return t;
+        }
+
+        Text copy(std::string_view s) { return copy(s.data(), s.size()); }
+
+        // Hands out size bytes for the caller to fill in. Needs queue storage,
+        // a default constructed arena returns nullptr.
+        char* allocate(size_t size)
+        {
+            auto* p = _next;
+            if (_next) _next += size;
+            return p;
+        }
+
+    private:
+        friend EventQueue;
+        explicit Arena(char* next) : _next(next) {}
+
+        char* _next = nullptr;
+    };
+
+    using Key  = std::function<std::string(const T&)>;
+    using Keep = std::function<bool(const T&)>;
+
+    explicit EventQueue(size_t capacity = 0, Backpressure policy = BACKPRESSURE_DROP_NEWEST, Key key = Key(),
+                        Keep keep = Keep(), std::chrono::milliseconds blockTimeout = std::chrono::milliseconds(1000))
+    : _capacity(capacity)
+    , _policy(policy)
+    , _key(std::move(key))
+    , _keep(std::move(keep))
+    , _blockTimeout(blockTimeout)
+    {
+        _head = _tail = new Segment();
+    }
+
+    ~EventQueue()
+    {
+        flush();
+        consume_all([] (const T&) {});
+        recycleRetired();
+        delete _head;
+
+        auto* s = _pool.load();
+        while (s) { auto* n = s->pooled; delete s; s = n; }
+    }
+
+    EventQueue(const EventQueue&)            = delete;
+    EventQueue& operator=(const EventQueue&) = delete;
+
+    // --- Producer
+
+    bool push(T&& event)
+    {
+        return emplace(0, [&] (T& e, Arena&) { e = std::move(event); });
+    }
+
+    // Constructs an event in place. `bytes` is the total size of the strings
+    // build(T&, Arena&) is going to copy into the arena.
+    template <typename F>
+    bool emplace(size_t bytes, F&& build)
+    {
+        if (bytes > ArenaSize) { return drop(); }
+
+        auto bounded = _capacity && (full() || _overflowing.load(std::memory_order_acquire));
+        if (bounded && _policy == BACKPRESSURE_COALESCE)
+        {
+            flush();
+            return coalesce(bytes, build);
+        }
+
+        auto* t = _tail;
+        auto  w = t->written.load(std::memory_order_relaxed) + _staged;
+        if (w == SegmentSize || t->used + bytes > ArenaSize)
+        {
+            // The consumer moves on to the next segment once it sees it
+            flush();
+
+            auto* n = takeSegment();
+            if (!n) { return drop(); }
+
+            t->next.store(n, std::memory_order_release);
+            _tail = t = n;
+            w = 0;
+        }
+
+        // Built before the policy applies, which spares the events to keep
+        auto* e = new (t->slot(w)) T();
+        auto  a = Arena(t->bytes + t->used);
+        build(*e, a);
+        if (bounded && !(_keep && _keep(*e)) && !makeRoom())
+        {
+            e->~T();
+            return drop();
+        }
+        t->used += bytes;
+
+        ++_staged;
+        if (!_holding) flush();
+        return true;
+    }
+
+    // Stages the following events until publish()
+    void hold() { _holding = true; }
+
+    // Hands the staged events to the consumer at once
+    void publish()
+    {
+        _holding = false;
+        flush();
+    }
+
+    // --- Consumer
+
+    // Calls f for every queued event. The event is moved out of the queue
+    // before f runs, so f may call poll() again without seeing it twice.
+    template <typename F>
+    size_t consume_all(F&& f)
+    {
+        _notifier.reset();
+
+        auto count = drain(f);
+
+        // The queue takes no events while the overflow is in use, so whatever
+        // it holds once the overflow is taken is older than the overflow
+        if (_overflowing.load(std::memory_order_acquire))
+        {
+            OverflowList overflow;
+            {
+                std::lock_guard<std::mutex> lock(_overflowMutex);
+                overflow.swap(_overflow);
+                _overflowIndex.clear();
+                _overflowSize.store(0);
+            }
+
+            count += drain(f);
+            for (auto& o : overflow)
+            {
+                ++count;
+                f(o.event);
+            }
+
+            std::lock_guard<std::mutex> lock(_overflowMutex);
+            if (_overflow.empty())
+                _overflowing.store(false, std::memory_order_release);
+        }
+
+        // Events published while draining didn't see an empty queue
+        if (!empty())
+            _notifier.notify();
+
+        return count;
+    }
+
+    // Moves every queued event to the back of out, for a consumer which handles
+    // them later, under a lock the producer may hold. Their strings stay valid
+    // until taken(), which ends every take() and may be nested within them.
+    size_t take(std::vector<T>& out)
+    {
+        _notifier.reset();
+        ++_takes;
+        _taking.store(true);
+
+        auto count = out.size();
+        popAll(out);
+
+        // As in consume_all(), the queue is older than the overflow
+        if (_overflowing.load(std::memory_order_acquire))
+        {
+            OverflowList overflow;
+            {
+                std::lock_guard<std::mutex> lock(_overflowMutex);
+                overflow.swap(_overflow);
+                _overflowIndex.clear();
+                _overflowSize.store(0);
+            }
+
+            popAll(out);
+            for (auto& o : overflow) out.push_back(std::move(o.event));
+            _taken.splice(_taken.end(), overflow);
+
+            std::lock_guard<std::mutex> lock(_overflowMutex);
+            if (_overflow.empty())
+                _overflowing.store(false, std::memory_order_release);
+        }
+
+        // A blocked producer goes on, and doesn't block again until taken()
+        if (_blocked.load())
+        {
+            std::lock_guard<std::mutex> lock(_roomMutex);
+            _room.notify_one();
+        }
+
+        if (!empty())
+            _notifier.notify();
+
+        return out.size() - count;
+    }
+
+    void taken()
+    {
+        if (--_takes) return;
+
+        std::unique_lock<std::mutex> lock(_consumer, std::defer_lock);
+        if (_policy == BACKPRESSURE_DROP_OLDEST) lock.lock();
+
+        recycleRetired();
+        _taken.clear();
+        _taking.store(false);
+    }
+
+    // --- Statistics, safe from any thread
+
+    bool   empty()     const { return size() == 0; }
+    size_t size()      const { return _size.load(std::memory_order_acquire) + _overflowSize.load(std::memory_order_acquire); }
+    size_t dropped()   const { return _dropped.load(std::memory_order_relaxed); }
+    size_t coalesced() const { return _coalesced.load(std::memory_order_relaxed); }
+    size_t highWater() const { return _highWater.load(std::memory_order_relaxed); }
+
+    int    nativeHandle() const { return _notifier.handle(); }
+
+    // Wakes a blocked consumer without queueing anything
+    void wake() { _notifier.notify(); }
+
+    // Blocks the consumer until events are queued. Returns false on timeout.
+    bool wait(std::chrono::milliseconds timeout)
+    {
+        return !empty() || _notifier.wait(timeout);
+    }
+
+private:
+
+    template <typename F>
+    size_t drain(F& f)
+    {
+        size_t count = 0;
+        for (;;)
+        {
+            T event;
+            {
+                std::unique_lock<std::mutex> lock(_consumer, std::defer_lock);
+                if (_policy == BACKPRESSURE_DROP_OLDEST) lock.lock();
+
+                recycleRetired();
+                if (!pop(event)) { break; }
+            }
+            ++count;
+
+            if (_blocked.load())
+            {
+                std::lock_guard<std::mutex> lock(_roomMutex);
+                _room.notify_one();
+            }
+
+            f(event);
+        }
+        return count;
+    }
+
+    // Parks the drained segments for taken()
+    void popAll(std::vector<T>& out)
+    {
+        std::unique_lock<std::mutex> lock(_consumer, std::defer_lock);
+        if (_policy == BACKPRESSURE_DROP_OLDEST) lock.lock();
+
+        T event;
+        while (pop(event, false)) out.push_back(std::move(event));
+    }
+
+    // Event parked by BACKPRESSURE_COALESCE, owning its strings
+    struct Overflow
+    {
+        std::string       key;
+        std::vector<char> bytes;
+        T                 event;
+    };
+
+    bool full() const { return _size.load() + _staged >= _capacity; }
+
+    // Publishes the events staged in the tail segment
+    void flush()
+    {
+        if (!_staged) return;
+
+        auto* t = _tail;
+        t->written.store(t->written.load(std::memory_order_relaxed) + _staged, std::memory_order_release);
+
+        auto size = _size.fetch_add(_staged, std::memory_order_acq_rel) + _staged;
+        if (size > _highWater.load(std::memory_order_relaxed))
+            _highWater.store(size, std::memory_order_relaxed);
+
+        if (size == _staged)
+            _notifier.notify();
+
+        _staged = 0;
+    }
+
+    bool drop()
+    {
+        _dropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    // Applies the policy to an event beyond capacity, false if it is dropped
+    bool makeRoom()
+    {
+        // The policies deal with what the consumer can see
+        flush();
+
+        switch (_policy)
+        {
+            case BACKPRESSURE_DROP_OLDEST: { return dropOldest(); }
+            case BACKPRESSURE_BLOCK:       { return waitForRoom(); }
+            default:                       { return false; }
+        }
+    }
+
+    bool dropOldest()
+    {
+        std::lock_guard<std::mutex> lock(_consumer);
+
+        auto* oldest = front();
+        if (!oldest || (_keep && _keep(*oldest))) { return false; }
+
+        T event;
+        if (pop(event, false)) drop();
+        return true;
+    }
+
+    // The oldest event, _consumer held
+    T* front()
+    {
+        for (auto* s = _head; s; s = s->next.load(std::memory_order_acquire))
+            if (s->read < s->written.load(std::memory_order_acquire)) { return s->slot(s->read); }
+        return nullptr;
+    }
+
+    bool waitForRoom()
+    {
+        std::unique_lock<std::mutex> lock(_roomMutex);
+        _blocked.store(true);
+        auto room = _room.wait_for(lock, _blockTimeout, [this] { return !full() || _taking.load(); });
+        _blocked.store(false);
+        return room;
+    }
+
+    template <typename F>
+    bool coalesce(size_t bytes, F&& build)
+    {
+        Overflow o;
+        o.bytes.resize(bytes);
+
+        auto a = Arena(o.bytes.data());
+        build(o.event, a);
+        if (_key) o.key = _key(o.event);
+
+        std::lock_guard<std::mutex> lock(_overflowMutex);
+
+        // The replacement goes to the back, behind everything queued meanwhile
+        auto it = _overflowIndex.find(o.key);
+        if (it != _overflowIndex.end())
+        {
+            _overflow.erase(it->second);
+            _coalesced.fetch_add(1, std::memory_order_relaxed);
+        }
+        else
+            _overflowSize.fetch_add(1);
+
+        _overflow.push_back(std::move(o));
+        _overflowIndex[_overflow.back().key] = std::prev(_overflow.end());
+
+        if (!_overflowing.exchange(true, std::memory_order_acq_rel))
+            _notifier.notify();
+
+        return true;
+    }
+
+    // Moves the oldest event out of the queue. The producer pops too under
+    // BACKPRESSURE_DROP_OLDEST, it and take() park drained segments instead of
+    // recycling them, as the consumer may still be reading strings from them.
+    bool pop(T& out, bool consumer = true)
+    {
+        for (;;)
+        {
+            auto* s = _head;
+            if (s->read < s->written.load(std::memory_order_acquire))
+            {
+                auto* slot = s->slot(s->read++);
+                out = std::move(*slot);
+                slot->~T();
+                _size.fetch_sub(1);
+                return true;
+            }
+
+            auto* n = s->next.load(std::memory_order_acquire);
+            if (!n) { return false; }
+            if (s->read < s->written.load(std::memory_order_acquire)) { continue; }
+
+            _head = n;
+            if (consumer) { recycle(s); }
+            else          { s->pooled = _retired; _retired = s; }
+        }
+    }
+
+    void recycleRetired()
+    {
+        while (_retired)
+        {
+            auto* s  = _retired;
+            _retired = s->pooled;
+            recycle(s);
+        }
+    }
+
+    // The pool is a stack with one pushing thread (consumer) and one popping
+    // thread (producer). With a single popper a node can't be popped and pushed
+    // back behind its back, so the plain CAS loop is free of ABA.
+    Segment* takeSegment()
+    {
+        auto* s = _pool.load(std::memory_order_acquire);
+        while (s && !_pool.compare_exchange_weak(s, s->pooled, std::memory_order_acquire))
+        {}
+
+        if (s) { s->pooled = nullptr; return s; }
+        return new (std::nothrow) Segment();
+    }
+
+    void recycle(Segment* s)
+    {
+        s->written.store(0, std::memory_order_relaxed);
+        s->used = 0;
+        s->read = 0;
+        s->next.store(nullptr, std::memory_order_relaxed);
+
+        s->pooled = _pool.load(std::memory_order_relaxed);
+        while (!_pool.compare_exchange_weak(s->pooled, s, std::memory_order_release))
+        {}
+    }
+
+    using OverflowList  = std::list<Overflow>;
+    using OverflowIndex = std::unordered_map<std::string, typename OverflowList::iterator>;
+
+    const size_t                    _capacity;
+    const Backpressure              _policy;
+    const Key                       _key;
+    const Keep                      _keep;
+    const std::chrono::milliseconds _blockTimeout;
+
+    Segment*              _head    = nullptr;  // consumer, or _consumer held
+    Segment*              _tail    = nullptr;  // producer only
+    size_t                _staged  = 0;        // events written to _tail but not published, producer only
+    bool                  _holding = false;    // producer only
+    Segment*              _retired = nullptr;  // drained by the producer or take(), _consumer held
+    std::atomic<Segment*> _pool    = {nullptr};
+
+    std::atomic<size_t>   _size      = {0};
+    std::atomic<size_t>   _dropped   = {0};
+    std::atomic<size_t>   _coalesced = {0};
+    std::atomic<size_t>   _highWater = {0};
+
+    // BACKPRESSURE_DROP_OLDEST
+    std::mutex            _consumer;
+
+    // BACKPRESSURE_BLOCK
+    std::mutex              _roomMutex;
+    std::condition_variable _room;
+    std::atomic<bool>       _blocked = {false};
+    std::atomic<bool>       _taking  = {false};  // between take() and taken()
+    int                     _takes   = 0;        // consumer only
+
+    // BACKPRESSURE_COALESCE
+    std::mutex            _overflowMutex;
+    OverflowList          _overflow;
+    OverflowIndex         _overflowIndex;
+    std::atomic<size_t>   _overflowSize = {0};
+    std::atomic<bool>     _overflowing  = {false};
+    OverflowList          _taken;                   // owns the strings of taken events, consumer only
+
+    Notifier              _notifier;
+};
+
+}
@@ -0,0 +1,86 @@
+// Copyright (c) 2017  Mathias Roder (teuse@mailbox.org)
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+#include <list>
+#include <string>
+#include <unordered_map>
+
+
+namespace zeroconf {
+
+//------------------------------------------------------------------------------
+
+// Services kept under continuous resolution, least recently used first. The
+// number is capped, a service touched beyond the cap pushes out the one used
+// longest ago, which falls back to one-shot resolution.
+
+class MonitorList
+{
+public:
+
+    explicit MonitorList(size_t capacity) : _capacity(capacity) {}
+
+    bool   enabled() const { return _capacity != 0; }
+    size_t size()    const { return _order.size(); }
+
+    bool contains(const std::string& key) const { return _index.count(key) != 0; }
+
+    // Marks key as used just now, adding it if needed. Returns true and the key
+    // of the service to demote if that went beyond the cap.
+    bool touch(const std::string& key, std::string& demoted)
+    {
+        auto it = _index.find(key);
+        if (it != _index.end())
+        {
+            _order.splice(_order.end(), _order, it->second);
+            return false;
+        }
+
+        _index[key] = _order.insert(_order.end(), key);
+        if (_order.size() <= _capacity) return false;
+
+        demoted = std::move(_order.front());
+        _order.pop_front();
+        _index.erase(demoted);
+        return true;
+    }
+
+    // Returns false if key wasn't monitored
+    bool erase(const std::string& key)
+    {
+        auto it = _index.find(key);
+        if (it == _index.end()) return false;
+
+        _order.erase(it->second);
+        _index.erase(it);
+        return true;
+    }
+
+    void clear()
+    {
+        _order.clear();
+        _index.clear();
+    }
+
+private:
+
+    using Order = std::list<std::string>;
+
+    const size_t                                      _capacity;
+    Order                                             _order;
+    std::unordered_map<std::string, Order::iterator>  _index;
+};
+
+}
@@ -0,0 +1,122 @@
+// Copyright (c) 2017  Mathias Roder (teuse@mailbox.org)
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#if defined(__linux__)
+    #include <sys/eventfd.h>
+    #include <unistd.h>
+#elif !defined(_WIN32)
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+
+namespace zeroconf {
+
+//------------------------------------------------------------------------------
+
+// Wakes the consumer of a queue when events arrive, either through a file
+// descriptor for epoll/select or by blocking in wait(). Uses an eventfd on
+// Linux and a pipe on other posix systems. There is no handle on Windows,
+// handle() returns -1 there but wait() works everywhere.
+
+class Notifier
+{
+public:
+    Notifier()
+    {
+#if defined(__linux__)
+        _fd[0] = _fd[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+#elif !defined(_WIN32)
+        if (pipe(_fd) == 0)
+        {
+            for (auto fd : _fd)
+            {
+                fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+                fcntl(fd, F_SETFD, FD_CLOEXEC);
+            }
+        }
+#endif
+    }
+
+    ~Notifier()
+    {
+#if !defined(_WIN32)
+        if (_fd[0] >= 0)                       close(_fd[0]);
+        if (_fd[1] >= 0 && _fd[1] != _fd[0])   close(_fd[1]);
+#endif
+    }
+
+    Notifier(const Notifier&)            = delete;
+    Notifier& operator=(const Notifier&) = delete;
+
+    int handle() const { return _fd[0]; }
+
+    // Producer side, makes the handle readable and wakes wait()
+    void notify()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _signalled = true;
+        }
+        _cv.notify_all();
+
+#if !defined(_WIN32)
+        if (_fd[1] < 0) return;
+
+        uint64_t one = 1;
+        auto ret = write(_fd[1], &one, sizeof(one));
+        (void)ret;
+#endif
+    }
+
+    // Consumer side, drains the handle before the queue is consumed
+    void reset()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _signalled = false;
+        }
+
+#if !defined(_WIN32)
+        if (_fd[0] < 0) return;
+
+        uint64_t buffer[8];
+        while (read(_fd[0], buffer, sizeof(buffer)) > 0)
+        {}
+#endif
+    }
+
+    // Consumer side, blocks until notify() or timeout. Returns false on timeout.
+    bool wait(std::chrono::milliseconds timeout)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        return _cv.wait_for(lock, timeout, [this] { return _signalled; });
+    }
+
+private:
+    int                     _fd[2] = {-1, -1};
+
+    std::mutex              _mutex;
+    std::condition_variable _cv;
+    bool                    _signalled = false;
+};
+
+}
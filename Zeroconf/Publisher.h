@@ -13,7 +13,10 @@
 //  You should have received a copy of the GNU General Public License
 //  along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #pragma once
-#include <boost/signals2.hpp>
+#include <Zeroconf/Context.h>
+#include <Zeroconf/Service.h>
+#include <Zeroconf/Signal.h>
+
 
 #include <memory>
 #include <string>
@@ -25,22 +28,51 @@ namespace zeroconf {
 
 class Publisher
 {
-   using Connection = boost::signals2::connection; 
-
 public:
 
     enum Error 
     {
         ZC_SERVICE_REGISTRATION_FAILED = -1,
         ZC_SERVICE_NAME_COLLISION      = -2,
+        ZC_SERVICE_EVENTS_LOST         = -3,    // the event queue dropped events since the last poll()
+    };
+
+    struct Statistics
+    {
+        size_t queued;      // events waiting for poll()
+        size_t dropped;     // events lost to the backpressure policy or because the queue couldn't grow
+        size_t coalesced;   // events replaced by a later one (BACKPRESSURE_COALESCE)
+        size_t highWater;   // largest number of events queued at once
+    };
+
+    struct Options
+    {
+        // Daemon connection to run on, nullptr shares Context::shared()
+        std::shared_ptr<Context> context;
+
+        Dispatch     dispatch      = DISPATCH_QUEUED;
+
+        // Bounds the event queue, 0 lets it grow as needed. Events which move
+        // the registration on, like its failure, are queued beyond the capacity,
+        // BACKPRESSURE_COALESCE merges repeats of the same event only.
+        size_t       queueCapacity = 0;
+        Backpressure backpressure  = BACKPRESSURE_DROP_NEWEST;
     };
 
 	Publisher();
+	explicit Publisher(const Options& options);
 	~Publisher();
 
     // Run processing loop
     void poll();
 
+    // Event queue counters, safe to call from any thread
+    Statistics statistics() const;
+
+    // File descriptor which becomes readable when poll() has work to do.
+    // Register it with epoll/select instead of calling poll() on a timer.
+    int nativeHandle() const;
+
     // Start/Stop Publishing a Service
 	void start(const std::string& name, const std::string& type, const std::string& domain, uint16_t port);
 	void stop();
@@ -54,10 +86,12 @@ public:
 private:
 
 	class Impl; friend Impl;
-    std::unique_ptr<Impl> _impl;
 	
-	boost::signals2::signal<void()>			_servicePublished;
-	boost::signals2::signal<void(Error)>	_error;
+	Signal<>		_servicePublished;
+	Signal<Error>	_error;
+
+    // Last, the backend emits signals until it is gone
+    std::unique_ptr<Impl> _impl;
 };
 
 }
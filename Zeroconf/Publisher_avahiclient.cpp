@@ -1,15 +1,16 @@
 #include "Publisher.h"
 
-#include <avahi-client/client.h>
-#include <avahi-client/publish.h>
 #include <avahi-common/error.h>
-#include <avahi-common/thread-watch.h>
-#include <avahi-client/lookup.h>
 
-#include <boost/lockfree/spsc_queue.hpp>
+#include "Context_avahiclient.h"
+#include "EventQueue.h"
 
-#include <iostream>
+#include <atomic>
+#include <cstdint>
 #include <map>
+#include <mutex>
+#include <string>
+#include <vector>
 
 namespace zeroconf {
 
@@ -17,19 +18,25 @@ namespace zeroconf {
 
 class Publisher::Impl
 {
-    using AvahiPollPtr       = std::unique_ptr<AvahiThreadedPoll,   decltype(&avahi_threaded_poll_free)>;
-    using AvahiClientPtr     = std::unique_ptr<::AvahiClient,       decltype(&avahi_client_free)>;
-    using AvahiEntryGroupPtr = std::unique_ptr<AvahiEntryGroup,     decltype(&avahi_entry_group_free)>;
+    using AvahiEntryGroupPtr = avahi::Ptr<avahi::EntryGroup>;
 
-    using QueueEvent = std::function<void()>;
-    using Queue      = boost::lockfree::spsc_queue<QueueEvent>;
+    // Entry group states handed from the avahi thread to poll()
+    struct Event
+    {
+        avahi::Id            group = 0;
+        AvahiEntryGroupState state = AVAHI_ENTRY_GROUP_UNCOMMITED;
+    };
+
+    using Queue = EventQueue<Event>;
 
 
 public:
-	Impl(Publisher* parent);
+	Impl(Publisher* parent, const Options& options);
 	~Impl();
 	
     void poll();
+    Statistics statistics() const;
+    int nativeHandle() const { return _queue.nativeHandle(); }
 
 	void start(const std::string& name, const std::string& type, const std::string& domain, unsigned port);
 	void stop();
@@ -37,112 +44,300 @@ public:
 
 private:
 
-    void servicePublished()           { _parent->_servicePublished(); }
-    void error(Error e)               { _parent->_error(e);           }
+    Context::Impl& context() const    { return *_context->_impl;      }
+    void servicePublished()           { emit([this]    { _parent->_servicePublished(); }); }
+    void error(Error e)               { emit([this, e] { _parent->_error(e);           }); }
+    void emit(std::function<void()>&& signal);
+    void emitHeld();
 
+    void dispatch(const Event& e);
+    void process(const Event& e);
+    static std::string key(const Event& e);
+    static bool keep(const Event& e);
     void onGroupCallback(AvahiEntryGroupState state);
+    void onStateChanged();
+    void sync();
+    void createGroup();
+    bool addService();
+
 
+    // Declared first, the entry group is freed before it
+    std::shared_ptr<Context> _context;
 
-    AvahiPollPtr       _poll       = {nullptr, &avahi_threaded_poll_free};
-    AvahiClientPtr     _client     = {nullptr, &avahi_client_free};
-    AvahiEntryGroupPtr _group      = {nullptr, &avahi_entry_group_free};
+    // The client the entry group lives on, nullptr while detached. Changes of
+    // the context client are picked up by sync(), which registers again.
+    Context::Impl::ClientPtr _client;
+    ScopedConnection    _stateConnection;
+    std::atomic<bool>   _syncPending = {false};
+    AvahiEntryGroupPtr _group      = {nullptr, &avahi::destroy};
+
+    // Between start() and stop(), and whether servicePublished was emitted
+    // since start(). A registration restored after a restart of the daemon
+    // isn't reported again.
+    bool            _active    = false;
+    bool            _published = false;
 
 	Publisher*	    _parent  = nullptr;
+    Dispatch        _dispatch;
     Queue           _queue;
+    std::vector<Event> _taken;      // reused by poll()
+    size_t          _lost = 0;      // drops already reported by poll()
     std::string     _name;
     std::string     _type;
     std::string     _domain;
     unsigned        _port;
 
+    // Guards the publisher state against the avahi thread in direct dispatch.
+    // Always taken after the poll lock.
+    std::recursive_mutex _mutex;
+
+    // Serializes poll(), taken before the poll lock
+    std::recursive_mutex _pollMutex;
+
+    // Signals poll() holds back until it released the locks
+    std::vector<std::function<void()>> _held;
+    bool            _holding  = false;
+    bool            _emitting = false;
+
 
     // --- AVAHI Callback
 
-	static void groupCallback(AvahiEntryGroup* g, AvahiEntryGroupState state, AVAHI_GCC_UNUSED void *userdata);
+	static void groupCallback(avahi::EntryGroup* g, AvahiEntryGroupState state, AVAHI_GCC_UNUSED void *userdata);
 };
 
 //------------------------------------------------------------------------------
 
-Publisher::Impl::Impl(Publisher *parent)
-: _parent(parent)
-, _queue(20)
+Publisher::Impl::Impl(Publisher *parent, const Options& options)
+: _context(options.context ? options.context : Context::shared())
+, _parent(parent)
+, _dispatch(options.dispatch)
+, _queue(options.queueCapacity, options.backpressure, &Impl::key, &Impl::keep)
 {
-    _poll.reset(avahi_threaded_poll_new());
-    if (!_poll) { std::cout << "Publisher: Failed to create poll" << std::endl; return; }
-
-  int ret = 0;
-  _client.reset(avahi_client_new(avahi_threaded_poll_get(_poll.get()), {}, nullptr, this, &ret));
-  if (!_client) { std::cout << "Publisher: Start avahi failed with error: " << avahi_strerror(ret) << std::endl; return; }
+    avahi::PollLock lock(context().poll());
+    _stateConnection = context().connectStateChanged([this] { onStateChanged(); });
 }
 
 Publisher::Impl::~Impl()
-{}
+{
+    avahi::PollLock lock(context().poll());
+    _stateConnection.disconnect();
+    stop();
+    _client.reset();
+}
 
 //---------------------------------------------------------------------
 
+// Handlers may call start() or stop(), locked in their order
 void Publisher::Impl::poll()
 {
-    _queue.consume_all([] (const auto& e) { e(); });
+    // Taken out before the poll lock, which the avahi thread holds while
+    // it waits for room under BACKPRESSURE_BLOCK
+    std::lock_guard<std::recursive_mutex> polling(_pollMutex);
+    auto events = std::vector<Event>();
+    events.swap(_taken);
+    _queue.take(events);
+
+    {
+        avahi::PollLock lock(context().poll());
+        std::lock_guard<std::recursive_mutex> guard(_mutex);
+        _holding = true;
+
+        for (const auto& e : events) process(e);
+        _queue.taken();
+        events.clear();
+        _taken.swap(events);
+
+        if (_syncPending.exchange(false))
+            sync();
+
+        auto dropped = _queue.dropped();
+        if (dropped != _lost) { _lost = dropped; error(ZC_SERVICE_EVENTS_LOST); }
+
+        _holding = false;
+    }
+    emitHeld();
+}
+
+Publisher::Statistics Publisher::Impl::statistics() const
+{
+    return { _queue.size(), _queue.dropped(), _queue.coalesced(), _queue.highWater() };
 }
 
 //------------------------------------------------------------------------------
 
+// Registered right away if the daemon is reachable, once it is otherwise
 void Publisher::Impl::start(const std::string& name, const std::string& type, const std::string& domain, unsigned port)
 {
-	if (_group) {
+    avahi::PollLock lock(context().poll());
+    std::lock_guard<std::recursive_mutex> guard(_mutex);
+
+	if (_active) {
         error(ZC_SERVICE_REGISTRATION_FAILED);
 		return;
 	}
 
-    _name   = name;
-    _type   = type;
-    _domain = domain;
-    _port   = port;
+    _name      = name;
+    _type      = type;
+    _domain    = domain;
+    _port      = port;
+    _active    = true;
+    _published = false;
 
-    _group.reset(avahi_entry_group_new(_client.get(), Publisher::Impl::groupCallback, this));
-	if (!_group)
-        error(ZC_SERVICE_REGISTRATION_FAILED);
+    sync();
+    if (_client && _active && !_group) createGroup();
 }
 
 void Publisher::Impl::stop()
 {
+    avahi::PollLock lock(context().poll());
+    std::lock_guard<std::recursive_mutex> guard(_mutex);
+    _active = false;
     _group.reset(nullptr);
 }
 
+//---------------------------------------------------------------------
+
+// Called on the poll thread with the poll lock held
+void Publisher::Impl::onStateChanged()
+{
+    if (_dispatch == DISPATCH_DIRECT)
+    {
+        std::lock_guard<std::recursive_mutex> lock(_mutex);
+        sync();
+        return;
+    }
+    _syncPending = true;
+    _queue.wake();
+}
+
+// Moves the registration to the current client of the context
+void Publisher::Impl::sync()
+{
+    avahi::PollLock lock(context().poll());
+
+    auto client = context().client();
+    if (_client && _client != client)
+    {
+        _group.reset(nullptr);
+        _client.reset();
+    }
+    if (!_client && client)
+    {
+        _client = client;
+        if (_active) createGroup();
+    }
+}
+
+void Publisher::Impl::createGroup()
+{
+    avahi::PollLock lock(context().poll());
+    _group.reset(avahi::newEntryGroup<&Publisher::Impl::groupCallback>(_client.get(), this));
+	if (!_group || !addService()) {
+        _group.reset(nullptr);
+        _active = false;
+        error(ZC_SERVICE_REGISTRATION_FAILED);
+    }
+}
+
+// Fills an empty group and commits it. Avahi-client reports a new group as
+// UNCOMMITED, avahi-core doesn't, both do after a reset.
+bool Publisher::Impl::addService()
+{
+    avahi::PollLock lock(context().poll());
+    if (!avahi::isEmpty(_group.get())) return true;
+
+    auto ret = avahi::addService(_client.get(), _group.get(), AVAHI_IF_UNSPEC, AVAHI_PROTO_UNSPEC, AVAHI_PUBLISH_UPDATE,
+                                 _name.c_str(), _type.c_str(), _domain.c_str(), NULL, _port);
+    if (ret >= 0)
+        ret = avahi::commit(_group.get());
+    return ret >= 0;
+}
+
+//---------------------------------------------------------------------
+
+void Publisher::Impl::dispatch(const Event& e)
+{
+    avahi::CallbackScope scope;
+
+    if (_dispatch == DISPATCH_QUEUED) { _queue.push(Event(e)); return; }
+
+    std::lock_guard<std::recursive_mutex> lock(_mutex);
+    process(e);
+    _queue.wake();
+}
+
+void Publisher::Impl::process(const Event& e)
+{
+    // Events of a group freed meanwhile may still have been queued, also when
+    // the new group took its memory
+    if (e.group == avahi::id(_group.get()))
+        onGroupCallback(e.state);
+}
+
+// poll() holds the signals back while it has the poll thread locked, a slow handler
+// doesn't stall it
+void Publisher::Impl::emit(std::function<void()>&& signal)
+{
+    if (_holding) _held.push_back(std::move(signal));
+    else          signal();
+}
+
+// A poll() from a handler leaves its signals to the one emitting, which keeps
+// them in order
+void Publisher::Impl::emitHeld()
+{
+    if (_emitting) return;
+
+    _emitting = true;
+    for (size_t i = 0; i < _held.size(); ++i)
+    {
+        auto signal = std::move(_held[i]);
+        signal();
+    }
+    _held.clear();
+    _emitting = false;
+}
+
+// BACKPRESSURE_COALESCE merges repeats of a state only, the states of a group
+// stay apart
+std::string Publisher::Impl::key(const Event& e)
+{
+    return std::to_string(e.group) + '/' + std::to_string(e.state);
+}
+
+// Every state but REGISTERING moves the registration on: published, failed,
+// or to be filled in again. Their loss would leave it stuck.
+bool Publisher::Impl::keep(const Event& e)
+{
+    return e.state != AVAHI_ENTRY_GROUP_REGISTERING;
+}
+
 //------------------------------------------------------------------------------
 // --- AVAHI Callbacks
 //------------------------------------------------------------------------------
 
-void Publisher::Impl::groupCallback(AvahiEntryGroup* group, AvahiEntryGroupState state, AVAHI_GCC_UNUSED void *userdata)
+void Publisher::Impl::groupCallback(avahi::EntryGroup* group, AvahiEntryGroupState state, AVAHI_GCC_UNUSED void *userdata)
 {
 	auto* THIS = static_cast<Publisher::Impl*>(userdata);
-    THIS->_queue.push([=]
-    { 
-        if (THIS->_group)
-            THIS->onGroupCallback(state); 
-    });
+    THIS->dispatch({avahi::id(group), state});
 }
 
 void Publisher::Impl::onGroupCallback(AvahiEntryGroupState state)
 {
     switch (state) 
     {
-        case AVAHI_ENTRY_GROUP_ESTABLISHED: { servicePublished(); break; }
+        case AVAHI_ENTRY_GROUP_ESTABLISHED: 
+        {
+            if (!_published) { _published = true; servicePublished(); }
+            break; 
+        }
         case AVAHI_ENTRY_GROUP_COLLISION:   { stop(); error(ZC_SERVICE_NAME_COLLISION); break; }
         case AVAHI_ENTRY_GROUP_FAILURE:     { stop(); error(ZC_SERVICE_REGISTRATION_FAILED); break; }
         case AVAHI_ENTRY_GROUP_REGISTERING: { break; }
         case AVAHI_ENTRY_GROUP_UNCOMMITED:  
         {
-            auto ret = avahi_entry_group_add_service(_group.get(), AVAHI_IF_UNSPEC, AVAHI_PROTO_UNSPEC, 
-                                                        AVAHI_PUBLISH_UPDATE, _name.c_str(), _type.c_str(), _domain.c_str(), NULL, _port, NULL);
-            if (ret < 0) {
-                _group.reset(nullptr); error(ZC_SERVICE_REGISTRATION_FAILED); break; 
-            }
-            else
-            {
-                ret = avahi_entry_group_commit(_group.get());
-                if (ret < 0) {
-                    _group.reset(nullptr); error(ZC_SERVICE_REGISTRATION_FAILED); break; 
-                }
+            if (!addService()) {
+                stop(); error(ZC_SERVICE_REGISTRATION_FAILED); 
             }
             break; 
         }
@@ -154,7 +349,8 @@ void Publisher::Impl::onGroupCallback(AvahiEntryGroupState state)
 //--- Publisher
 //---------------------------------------------------------------------
 
-Publisher::Publisher() 	{ _impl = std::make_unique<Impl>(this); }
+Publisher::Publisher()                          : Publisher(Options()) {}
+Publisher::Publisher(const Options& options)    { _impl = std::make_unique<Impl>(this, options); }
 Publisher::~Publisher()   {}
 
 //---------------------------------------------------------------------
@@ -166,5 +362,8 @@ void Publisher::start(const std::string& name, const std::string& type, const st
 
 void Publisher::stop()    { _impl->stop(); }
 void Publisher::poll()    { _impl->poll(); }
+
+Publisher::Statistics Publisher::statistics() const { return _impl->statistics(); }
+int Publisher::nativeHandle() const               { return _impl->nativeHandle(); }
 }
 
@@ -1,10 +1,11 @@
 #include "Publisher.h"
 #include <dns_sd.h>
 
-#include <boost/lockfree/spsc_queue.hpp>
+#include "Context_bonjour.h"
+#include "EventQueue.h"
 
-#include <thread>
 #include <map>
+#include <mutex>
 #include <vector>
 #include <string>
 #include <iostream>
@@ -22,28 +23,79 @@ namespace zeroconf {
 
 class Publisher::Impl
 {
-    using QueueEvent = std::function<void()>;
-    using Queue      = boost::lockfree::spsc_queue<QueueEvent>;
+    using Id = Context::Impl::Id;
+
+    // Replies handed from the reactor thread to poll()
+    struct Event
+    {
+        enum Kind { REGISTERED, FAILED, RECONNECT };
+
+        Kind                kind  = FAILED;
+        Id                  id    = 0;      // of the registration replying
+        DNSServiceErrorType error = kDNSServiceErr_NoError;
+    };
+
+    using Queue = EventQueue<Event>;
 
 public:
-	Impl(Publisher* parent);
+	Impl(Publisher* parent, const Options& options);
 	~Impl();
 
     void poll();
+    Statistics statistics() const;
+    int nativeHandle() const { return _queue.nativeHandle(); }
 
 	void start(const std::string& name, const std::string& type, const std::string& domain, uint16_t port);
 	void stop();
 
 private:
 
-    void servicePublished()           { _parent->_servicePublished(); }
-    void error(Publisher::Error e)    { _parent->_error(e);           }
-
-    void registerCallback(DNSServiceErrorType err);
-
+    Context::Impl& context() const    { return *_context->_impl;      }
+    void servicePublished()           { emit([this]    { _parent->_servicePublished(); }); }
+    void error(Publisher::Error e)    { emit([this, e] { _parent->_error(e);           }); }
+    void emit(std::function<void()>&& signal);
+    void emitHeld();
+
+    void dispatch(const Event& e);
+    void process(const Event& e);
+    static std::string key(const Event& e);
+    static bool keep(const Event& e);
+    void registerService();
+    void registerCallback(Id id, DNSServiceErrorType err);
+    void failed(Id id, DNSServiceErrorType err);
+    void reconnect();
+
+    std::shared_ptr<Context> _context;
 	Publisher*         _parent   = nullptr;
+    Dispatch           _dispatch;
     Queue              _queue;
+    std::vector<Event> _taken;          // reused by poll()
+    size_t             _lost     = 0;   // drops already reported by poll()
 	DNSServiceRef      _dnssRef  = nullptr;
+    Id                 _id       = 0;       // of the registration, replies are matched by it
+    std::string        _name;
+    std::string        _type;
+    std::string        _domain;
+    uint16_t           _port     = 0;
+
+    // Between start() and stop(), and whether servicePublished was emitted
+    // since start(). After a restart of mDNSResponder the service is
+    // registered again without being reported again.
+    bool               _active       = false;
+    bool               _published    = false;
+    bool               _disconnected = false;
+    Connection         _stateConnection;
+
+    // Guards the publisher state against the reactor thread in direct dispatch
+    std::recursive_mutex _mutex;
+
+    // Serializes poll(), taken before the reactor lock
+    std::recursive_mutex _pollMutex;
+
+    // Signals poll() holds back until it released the locks
+    std::vector<std::function<void()>> _held;
+    bool               _holding  = false;
+    bool               _emitting = false;
 
 
     // --- Bonjour Callback
@@ -54,82 +106,211 @@ private:
 
 //---------------------------------------------------------------------
 
-Publisher::Impl::Impl(Publisher *parent)
-: _parent(parent)
-, _queue(20)
-{}
+Publisher::Impl::Impl(Publisher *parent, const Options& options)
+: _context(options.context ? options.context : Context::shared())
+, _parent(parent)
+, _dispatch(options.dispatch)
+, _queue(options.queueCapacity, options.backpressure, &Impl::key, &Impl::keep)
+{
+    _stateConnection = context().connectStateChanged([this] { dispatch({Event::RECONNECT}); });
+}
 
 Publisher::Impl::~Impl()
 {
+    context().disconnect(_stateConnection);
     stop();
 }
 
 //---------------------------------------------------------------------
 
+// Handlers may call start() or stop(), failed() stops, locked in their order
 void Publisher::Impl::poll()
 {
-    _queue.consume_all([] (const auto& e) { e(); });
+    // Taken out before the reactor lock, which a reactor waiting for room
+    // under BACKPRESSURE_BLOCK holds
+    std::lock_guard<std::recursive_mutex> polling(_pollMutex);
+    auto events = std::vector<Event>();
+    events.swap(_taken);
+    _queue.take(events);
+
+    {
+        auto reactor = context().lock();
+        std::lock_guard<std::recursive_mutex> lock(_mutex);
+        _holding = true;
+
+        for (const auto& e : events) process(e);
+        _queue.taken();
+        events.clear();
+        _taken.swap(events);
+
+        auto dropped = _queue.dropped();
+        if (dropped != _lost) { _lost = dropped; error(ZC_SERVICE_EVENTS_LOST); }
+
+        _holding = false;
+    }
+    emitHeld();
+}
+
+Publisher::Statistics Publisher::Impl::statistics() const
+{
+    return { _queue.size(), _queue.dropped(), _queue.coalesced(), _queue.highWater() };
 }
 
 //---------------------------------------------------------------------
 
 void Publisher::Impl::start(const std::string& name, const std::string& type, const std::string& domain, uint16_t port)
 {
-    if (_dnssRef) { error(ZC_SERVICE_REGISTRATION_FAILED); return; }
+    auto reactor = context().lock();
+    std::lock_guard<std::recursive_mutex> lock(_mutex);
+
+    if (_active) { error(ZC_SERVICE_REGISTRATION_FAILED); return; }
+
+    _name      = name;
+    _type      = type;
+    _domain    = domain;
+    _port      = port;
+    _active    = true;
+    _published = false;
+    if (!_disconnected) registerService();
+}
 
+// The reactor serves the ref until it fails, a daemon which isn't running is waited for
+void Publisher::Impl::registerService()
+{
     //TODO: qFromBigEndian<uint16_t>(port)
-    auto err = DNSServiceRegister(&_dnssRef, 0, 0, name.c_str(), type.c_str(), domain.c_str(), NULL, port, 
-            0, NULL, (DNSServiceRegisterReply)Publisher::Impl::onRegisterCallback, this);
-
-    if (err != kDNSServiceErr_NoError) {
-        stop();
-        error(ZC_SERVICE_REGISTRATION_FAILED);
-        return;
-    }
+    auto call = [this] (DNSServiceRef* ref, DNSServiceFlags flags)
+    {
+        return DNSServiceRegister(ref, flags, 0, _name.c_str(), _type.c_str(), _domain.c_str(), NULL, _port,
+                0, NULL, (DNSServiceRegisterReply)Publisher::Impl::onRegisterCallback, this);
+    };
 
-    std::thread t([this]() 
+    auto err = context().start(_dnssRef, call, [this] (DNSServiceRef ref, DNSServiceErrorType err)
     {
-        auto err = DNSServiceProcessResult(_dnssRef);
-        if (err != kDNSServiceErr_NoError) 
-        {
-           _queue.push([this]{ stop(); error(ZC_SERVICE_REGISTRATION_FAILED); }); 
-        }
+        dispatch({Event::FAILED, context().id(ref), err});
     });
-    t.detach();
+    _id = _dnssRef ? context().id(_dnssRef) : 0;
+    if (err != kDNSServiceErr_NoError)
+        failed(0, err);
 }
 
 void Publisher::Impl::stop()
 {
-    if (_dnssRef) {
-        DNSServiceRefDeallocate(_dnssRef);
-        _dnssRef = nullptr;
+    auto reactor = context().lock();
+    std::lock_guard<std::recursive_mutex> lock(_mutex);
+
+    _active = false;
+    context().release(_dnssRef);
+    _dnssRef = nullptr;
+    _id      = 0;
+}
+
+//---------------------------------------------------------------------
+
+void Publisher::Impl::dispatch(const Event& e)
+{
+    if (_dispatch == DISPATCH_QUEUED) { _queue.push(Event(e)); return; }
+
+    std::lock_guard<std::recursive_mutex> lock(_mutex);
+    process(e);
+    _queue.wake();
+}
+
+void Publisher::Impl::process(const Event& e)
+{
+    switch (e.kind)
+    {
+        case Event::REGISTERED: { registerCallback(e.id, e.error); break; }
+        case Event::FAILED:     { failed(e.id, e.error);           break; }
+        case Event::RECONNECT:  { reconnect();                     break; }
     }
 }
 
+// poll() holds the signals back while it has the reactor locked, a slow handler
+// doesn't stall it
+void Publisher::Impl::emit(std::function<void()>&& signal)
+{
+    if (_holding) _held.push_back(std::move(signal));
+    else          signal();
+}
+
+// A poll() from a handler leaves its signals to the one emitting, which keeps
+// them in order
+void Publisher::Impl::emitHeld()
+{
+    if (_emitting) return;
+
+    _emitting = true;
+    for (size_t i = 0; i < _held.size(); ++i)
+    {
+        auto signal = std::move(_held[i]);
+        signal();
+    }
+    _held.clear();
+    _emitting = false;
+}
+
+// BACKPRESSURE_COALESCE merges repeats of the same reply only
+std::string Publisher::Impl::key(const Event& e)
+{
+    return std::to_string(e.kind) + '/' + std::to_string(e.id) + '/' + std::to_string(e.error);
+}
+
+// A registration has few events and each of them matters: the first reply
+// reports it published, failures stop it, RECONNECT registers it again
+bool Publisher::Impl::keep(const Event&)
+{
+    return true;
+}
+
 
 //---------------------------------------------------------------------
 //--- Bonjour Callbacks
 //---------------------------------------------------------------------
 
-void DNSSD_API Publisher::Impl::onRegisterCallback(DNSServiceRef, DNSServiceFlags, DNSServiceErrorType err, 
+void DNSSD_API Publisher::Impl::onRegisterCallback(DNSServiceRef sdRef, DNSServiceFlags, DNSServiceErrorType err, 
                                                    const char*, const char*, const char*, void* userdata)
 {
 	auto* THIS = static_cast<Publisher::Impl*>(userdata);
-    THIS->_queue.push([=]
-    { 
-        THIS->registerCallback(err); 
-    });
+    THIS->dispatch({Event::REGISTERED, THIS->context().id(sdRef), err});
 }
 
-void Publisher::Impl::registerCallback(DNSServiceErrorType err)
+void Publisher::Impl::registerCallback(Id id, DNSServiceErrorType err)
 {
+    // Replies of a registration stopped meanwhile may still have been queued
+    if (id != _id) return;
+
 	if (err == kDNSServiceErr_NoError) {
-		servicePublished();
-	}
-	else {
-        stop();
-		error(ZC_SERVICE_REGISTRATION_FAILED);
+        if (!_published) { _published = true; servicePublished(); }
 	}
+	else
+        failed(id, err);
+}
+
+// Called with the id of the registration which failed, 0 if it couldn't be
+// started. When mDNSResponder went away, the context tells when it is back.
+void Publisher::Impl::failed(Id id, DNSServiceErrorType err)
+{
+    if (id != _id) return;
+
+    if (err == kDNSServiceErr_ServiceNotRunning)
+    {
+        context().release(_dnssRef);
+        _dnssRef      = nullptr;
+        _id           = 0;
+        _disconnected = true;
+        context().lost();
+        return;
+    }
+    stop();
+    error(ZC_SERVICE_REGISTRATION_FAILED);
+}
+
+void Publisher::Impl::reconnect()
+{
+    if (!_disconnected) return;
+
+    _disconnected = false;
+    if (_active && !_dnssRef) registerService();
 }
 
 
@@ -137,7 +318,8 @@ void Publisher::Impl::registerCallback(DNSServiceErrorType err)
 //--- Publisher
 //---------------------------------------------------------------------
 
-Publisher::Publisher() 	{ _impl = std::make_unique<Impl>(this); }
+Publisher::Publisher()                          : Publisher(Options()) {}
+Publisher::Publisher(const Options& options)    { _impl = std::make_unique<Impl>(this, options); }
 Publisher::~Publisher()   {}
 
 //---------------------------------------------------------------------
@@ -150,4 +332,7 @@ void Publisher::start(const std::string& name, const std::string& type, const st
 void Publisher::stop()    { _impl->stop(); }
 void Publisher::poll()    { _impl->poll(); }
 
+Publisher::Statistics Publisher::statistics() const { return _impl->statistics(); }
+int Publisher::nativeHandle() const               { return _impl->nativeHandle(); }
+
 } 
@@ -0,0 +1,116 @@
+// Copyright (c) 2017  Mathias Roder (teuse@mailbox.org)
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+#include <Zeroconf/Service.h>
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+
+namespace zeroconf {
+
+//------------------------------------------------------------------------------
+
+// Resolves waiting for a free slot while the number of resolves in flight is
+// capped. Ordered by priority, higher first, and first come first served within
+// the same priority. Each service identity is queued at most once and can be
+// taken out again when the service goes away before its turn.
+
+class ResolveBacklog
+{
+    using Order = std::pair<int, uint64_t>;     // (priority, arrival)
+
+    // Higher priority first, then earlier arrival. Compared instead of
+    // negated, -INT_MIN overflows.
+    struct Earlier
+    {
+        bool operator()(const Order& a, const Order& b) const
+        {
+            if (a.first != b.first) return a.first > b.first;
+            return a.second < b.second;
+        }
+    };
+
+public:
+
+    using Priority = std::function<int(const Service&)>;
+
+    explicit ResolveBacklog(Priority priority = Priority())
+    : _priority(std::move(priority))
+    {}
+
+    bool   empty() const { return _queue.empty(); }
+    size_t size()  const { return _queue.size(); }
+
+    bool contains(const std::string& key) const { return _index.count(key) != 0; }
+
+    // Returns false if the identity is already queued
+    bool push(const std::string& key, const Service& service)
+    {
+        if (_index.count(key)) return false;
+
+        auto order = Order(_priority ? _priority(service) : 0, _arrival++);
+        _index[key] = _queue.emplace(order, Entry{key, service}).first;
+        return true;
+    }
+
+    // Takes the next resolve to start
+    std::pair<std::string, Service> pop()
+    {
+        auto it     = _queue.begin();
+        auto result = std::make_pair(std::move(it->second.key), std::move(it->second.service));
+        _index.erase(result.first);
+        _queue.erase(it);
+        return result;
+    }
+
+    // Returns false if the identity wasn't queued
+    bool erase(const std::string& key)
+    {
+        auto it = _index.find(key);
+        if (it == _index.end()) return false;
+
+        _queue.erase(it->second);
+        _index.erase(it);
+        return true;
+    }
+
+    void clear()
+    {
+        _queue.clear();
+        _index.clear();
+    }
+
+private:
+
+    struct Entry
+    {
+        std::string key;
+        Service     service;
+    };
+
+    using Queue = std::map<Order, Entry, Earlier>;
+
+    Priority                                          _priority;
+    Queue                                             _queue;
+    std::unordered_map<std::string, Queue::iterator>  _index;
+    uint64_t                                          _arrival = 0;
+};
+
+}
@@ -13,7 +13,10 @@
 //  You should have received a copy of the GNU General Public License
 //  along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #pragma once
+#include <Zeroconf/TxtRecord.h>
+
 #include <string>
+#include <vector>
 
 //-----------------------------------------------------------------------------
 
@@ -27,6 +30,31 @@ namespace zeroconf
         PROTOCOL_UNSPEC
     };
 
+    // Where Browser and Publisher deliver their callbacks
+    enum Dispatch
+    {
+        DISPATCH_QUEUED,    // from poll(), on the thread calling it
+        DISPATCH_DIRECT     // as soon as they arrive, on the backend thread
+    };
+
+    // What the backend thread does when the event queue is full
+    enum Backpressure
+    {
+        BACKPRESSURE_DROP_NEWEST,   // discard the event which doesn't fit
+        BACKPRESSURE_DROP_OLDEST,   // discard the oldest queued event to make room
+        BACKPRESSURE_BLOCK,         // wait for poll() to make room, drop after a timeout
+        BACKPRESSURE_COALESCE       // keep only the latest event per service
+    };
+
+    struct Address
+    {
+        Protocol        protocol;
+        std::string     address;
+    };
+
+    inline bool operator==(const Address& a, const Address& b) { return a.protocol == b.protocol && a.address == b.address; }
+    inline bool operator!=(const Address& a, const Address& b) { return !(a == b); }
+
     struct Service 
     {
         std::string	    name;
@@ -37,6 +65,23 @@ namespace zeroconf
         std::string     address;
         uint32_t        interface;
         uint16_t        port;
+
+        // Every address the instance was resolved to, IPv4 first. protocol and
+        // address above repeat the first of them.
+        std::vector<Address> addresses;
+
+        // Key/value attributes of the instance, empty until resolved
+        TxtRecord       txt;
     };
 
+    inline bool operator==(const Service& a, const Service& b)
+    {
+        return a.name      == b.name     && a.type     == b.type     && a.domain  == b.domain  &&
+               a.host      == b.host     && a.protocol == b.protocol && a.address == b.address &&
+               a.interface == b.interface && a.port    == b.port    && a.addresses == b.addresses &&
+               a.txt       == b.txt;
+    }
+
+    inline bool operator!=(const Service& a, const Service& b) { return !(a == b); }
+
 }
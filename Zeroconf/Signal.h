@@ -0,0 +1,215 @@
+// Copyright (c) 2017  Mathias Roder (teuse@mailbox.org)
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+
+namespace zeroconf {
+
+//------------------------------------------------------------------------------
+
+namespace detail
+{
+    struct SignalCore;
+
+    struct SlotBase
+    {
+        std::atomic<bool>         connected = {true};
+        std::weak_ptr<SignalCore> core;
+    };
+
+    struct SignalCore
+    {
+        virtual ~SignalCore() = default;
+        virtual void remove(const SlotBase* slot) = 0;
+    };
+}
+
+//------------------------------------------------------------------------------
+
+// Handle to a connected slot, may outlive the signal
+
+class Connection
+{
+public:
+    Connection() = default;
+    explicit Connection(std::weak_ptr<detail::SlotBase> slot) : _slot(std::move(slot)) {}
+
+    void disconnect()
+    {
+        auto slot = _slot.lock();
+        if (!slot || !slot->connected.exchange(false)) return;
+
+        if (auto core = slot->core.lock())
+            core->remove(slot.get());
+    }
+
+    bool connected() const
+    {
+        auto slot = _slot.lock();
+        return slot && slot->connected.load();
+    }
+
+private:
+    std::weak_ptr<detail::SlotBase> _slot;
+};
+
+//------------------------------------------------------------------------------
+
+// Disconnects when it goes out of scope
+
+class ScopedConnection
+{
+public:
+    ScopedConnection() = default;
+    ScopedConnection(Connection c) : _connection(std::move(c)) {}
+    ~ScopedConnection() { _connection.disconnect(); }
+
+    ScopedConnection(ScopedConnection&& other) : _connection(std::move(other._connection)) { other._connection = Connection(); }
+    ScopedConnection& operator=(ScopedConnection&& other)
+    {
+        if (this != &other) {
+            _connection.disconnect();
+            _connection = std::move(other._connection);
+            other._connection = Connection();
+        }
+        return *this;
+    }
+
+    void disconnect()       { _connection.disconnect(); }
+    bool connected() const  { return _connection.connected(); }
+
+private:
+    Connection _connection;
+};
+
+//------------------------------------------------------------------------------
+
+// Signal with a lock-free emit. The slot list is immutable once published:
+// connect and disconnect build a new list under a mutex and swap it in, emit
+// walks whatever list is current without locking, copying or allocating.
+// Replaced lists are freed as soon as no emit is running.
+
+template <typename... Args>
+class Signal
+{
+    struct Slot : detail::SlotBase
+    {
+        std::function<void(Args...)> handler;
+    };
+
+    using SlotList = std::vector<std::shared_ptr<Slot>>;
+
+    struct Core : detail::SignalCore
+    {
+        Core() : slots(new SlotList()) {}
+
+        ~Core()
+        {
+            delete slots.load();
+            for (auto* l : retired) delete l;
+        }
+
+        void remove(const detail::SlotBase* slot) override
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            auto* list  = new SlotList();
+            auto* old   = slots.load();
+            list->reserve(old->size());
+            for (const auto& s : *old)
+                if (s.get() != slot) list->push_back(s);
+
+            publish(list);
+        }
+
+        // Called with mutex held
+        void publish(SlotList* list)
+        {
+            retired.push_back(slots.exchange(list));
+
+            // An emit which could still see a retired list has announced
+            // itself in readers before loading the list pointer
+            if (readers.load() == 0)
+            {
+                for (auto* l : retired) delete l;
+                retired.clear();
+            }
+        }
+
+        std::atomic<SlotList*>  slots;
+        std::atomic<int>        readers = {0};
+
+        std::mutex              mutex;
+        std::vector<SlotList*>  retired;
+    };
+
+    struct ReadGuard
+    {
+        ReadGuard(Core& c) : core(c)  { core.readers.fetch_add(1); }
+        ~ReadGuard()                  { core.readers.fetch_sub(1); }
+
+        Core& core;
+    };
+
+public:
+    Signal() : _core(std::make_shared<Core>()) {}
+
+    Signal(const Signal&)            = delete;
+    Signal& operator=(const Signal&) = delete;
+
+    Connection connect(std::function<void(Args...)> handler)
+    {
+        auto slot = std::make_shared<Slot>();
+        slot->handler = std::move(handler);
+        slot->core    = _core;
+
+        std::lock_guard<std::mutex> lock(_core->mutex);
+
+        auto* old  = _core->slots.load();
+        auto* list = new SlotList(*old);
+        list->push_back(slot);
+        _core->publish(list);
+
+        return Connection(slot);
+    }
+
+    void operator()(Args... args) const
+    {
+        ReadGuard guard(*_core);
+
+        const auto* list = _core->slots.load();
+        for (const auto& s : *list)
+        {
+            if (s->connected.load(std::memory_order_acquire))
+                s->handler(args...);
+        }
+    }
+
+    bool empty() const
+    {
+        ReadGuard guard(*_core);
+        return _core->slots.load()->empty();
+    }
+
+private:
+    std::shared_ptr<Core> _core;
+};
+
+}
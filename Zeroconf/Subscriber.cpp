@@ -0,0 +1,197 @@
+#include "Subscriber.h"
+
+#include "EventQueue.h"
+
+#include <cstring>
+
+namespace zeroconf {
+
+//---------------------------------------------------------------------
+//--- Subscriber::Feed
+//---------------------------------------------------------------------
+
+// The queue between the browser and one subscriber. Shared with the handler
+// connected to the browser, which may still be running when the subscriber
+// goes away.
+
+class Subscriber::Feed
+{
+public:
+
+    // A change with a snapshot of the service, taken while the browser holds it still
+    struct Event
+    {
+        Browser::Change kind      = Browser::CLEARED;
+        Protocol        protocol  = PROTOCOL_UNSPEC;
+        uint32_t        interface = 0;
+        uint16_t        port      = 0;
+        Text            name;
+        Text            type;
+        Text            domain;
+        Text            host;
+        Text            address;
+        Text            addresses;  // per address: protocol byte, address, '\0'
+        Text            txt;        // wire format
+    };
+
+    using Queue = EventQueue<Event>;
+
+    Feed(const Options& options)
+    : queue(options.queueCapacity, options.backpressure, &Feed::key)
+    {}
+
+    void push(Browser::Change kind, const ServicePtr& s)
+    {
+        if (!s) { queue.emplace(0, [=] (Event& e, Queue::Arena&) { e.kind = kind; }); return; }
+
+        auto packed = size_t(0);
+        for (const auto& a : s->addresses)
+            packed += a.address.size() + 2;
+
+        auto bytes = s->name.size() + s->type.size() + s->domain.size() + s->host.size() + s->address.size() + packed
+                   + s->txt.data().size();
+        queue.emplace(bytes, [&] (Event& e, Queue::Arena& arena)
+        {
+            e.kind      = kind;
+            e.protocol  = s->protocol;
+            e.interface = s->interface;
+            e.port      = s->port;
+            e.name      = arena.copy(s->name);
+            e.type      = arena.copy(s->type);
+            e.domain    = arena.copy(s->domain);
+            e.host      = arena.copy(s->host);
+            e.address   = arena.copy(s->address);
+            e.txt       = arena.copy(s->txt.data());
+
+            auto* p = arena.allocate(packed);
+            e.addresses.data = p;
+            e.addresses.size = packed;
+            for (const auto& a : s->addresses)
+            {
+                *p++ = static_cast<char>(a.protocol);
+                std::memcpy(p, a.address.c_str(), a.address.size() + 1);
+                p += a.address.size() + 1;
+            }
+        });
+    }
+
+    static void unpack(const Text& packed, std::vector<Address>& addresses)
+    {
+        addresses.clear();
+        for (auto* p = packed.data, *end = packed.data + packed.size; p < end; )
+        {
+            auto protocol = static_cast<Protocol>(*p++);
+            auto length   = std::strlen(p);
+            addresses.push_back({protocol, std::string(p, length)});
+            p += length + 1;
+        }
+    }
+
+    // A service is the instance of a type on an interface
+    static std::string identity(const Event& e)
+    {
+        auto id = e.name.str();
+        id.push_back('\0');
+        id.append(e.type.data, e.type.size).push_back('\0');
+        id.append(e.domain.data, e.domain.size).push_back('\0');
+        return id + std::to_string(e.interface);
+    }
+
+    // BACKPRESSURE_COALESCE keeps the latest change per service
+    static std::string key(const Event& e)
+    {
+        return e.kind == Browser::CLEARED ? "c" : "s" + identity(e);
+    }
+
+    Queue queue;
+};
+
+//---------------------------------------------------------------------
+//--- Subscriber
+//---------------------------------------------------------------------
+
+Subscriber::Subscriber(Browser& browser) : Subscriber(browser, Options()) {}
+
+Subscriber::Subscriber(Browser& browser, const Options& options)
+: _feed(std::make_shared<Feed>(options))
+{
+    auto feed   = _feed;
+    _connection = browser.subscribe([feed] (Browser::Change kind, ServicePtr s) { feed->push(kind, s); });
+}
+
+Subscriber::~Subscriber() = default;
+
+//---------------------------------------------------------------------
+
+void Subscriber::poll()
+{
+    _feed->queue.consume_all([this] (const Feed::Event& e)
+    {
+        if (e.kind == Browser::CLEARED) { _services.clear(); return; }
+
+        auto id = Feed::identity(e);
+        auto it = _services.find(id);
+        if (e.kind == Browser::REMOVED)
+        {
+            if (it == _services.end()) return;
+
+            auto service = it->second;
+            _services.erase(it);
+            _serviceRemoved(service);
+            return;
+        }
+
+        // A coalesced queue may deliver the update of a service it never added
+        auto isNew = it == _services.end();
+        auto zcs   = isNew ? std::make_shared<Service>() : it->second;
+        zcs->name      = e.name.str();
+        zcs->type      = e.type.str();
+        zcs->domain    = e.domain.str();
+        zcs->host      = e.host.str();
+        zcs->protocol  = e.protocol;
+        zcs->address   = e.address.str();
+        zcs->interface = e.interface;
+        zcs->port      = e.port;
+        zcs->txt       = TxtRecord(e.txt.view());
+        Feed::unpack(e.addresses, zcs->addresses);
+
+        if (isNew) { _services[id] = zcs; _serviceAdded(zcs); }
+        else       { _serviceUpdated(zcs); }
+    });
+
+    auto dropped = _feed->queue.dropped();
+    if (dropped != _lost) { _lost = dropped; _error(Browser::ZC_BROWSER_EVENTS_LOST); }
+}
+
+void Subscriber::poll(std::chrono::milliseconds timeout)
+{
+    _feed->queue.wait(timeout);
+    poll();
+}
+
+std::vector<ServicePtr> Subscriber::services() const
+{
+    auto result = std::vector<ServicePtr>();
+    result.reserve(_services.size());
+    for (const auto& s : _services)
+        result.push_back(s.second);
+    return result;
+}
+
+Subscriber::Statistics Subscriber::statistics() const
+{
+    const auto& q = _feed->queue;
+    return { q.size(), q.dropped(), q.coalesced(), q.highWater() };
+}
+
+int Subscriber::nativeHandle() const
+{
+    return _feed->queue.nativeHandle();
+}
+
+void Subscriber::detach()
+{
+    _connection.disconnect();
+}
+
+}
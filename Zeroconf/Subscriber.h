@@ -0,0 +1,110 @@
+// Copyright (c) 2017  Mathias Roder (teuse@mailbox.org)
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+#include <Zeroconf/Browser.h>
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+namespace zeroconf {
+
+//------------------------------------------------------------------------------
+
+// Receives the services of a Browser on another thread. Each subscriber has its
+// own queue, drained by its own poll(), and its own copies of the services, so
+// several worker threads can share one browse. Subscribers can be created and
+// destroyed at any time, a new one starts with the services known so far.
+//
+// The queue is fed wherever the Browser emits its signals: on the backend
+// thread with DISPATCH_DIRECT, from Browser::poll() otherwise.
+
+class Subscriber
+{
+public:
+
+    struct Statistics
+    {
+        size_t queued;      // changes waiting for poll()
+        size_t dropped;     // changes lost to the backpressure policy
+        size_t coalesced;   // changes replaced by a later one for the same service
+        size_t highWater;   // largest number of changes queued at once
+    };
+
+    struct Options
+    {
+        size_t       queueCapacity = 0;
+        Backpressure backpressure  = BACKPRESSURE_DROP_NEWEST;
+    };
+
+    explicit Subscriber(Browser& browser);
+    Subscriber(Browser& browser, const Options& options);
+    ~Subscriber();
+
+    Subscriber(const Subscriber&)            = delete;
+    Subscriber& operator=(const Subscriber&) = delete;
+
+    // Run processing loop, on the thread owning this subscriber
+    void poll();
+
+    // Blocks up to timeout until changes arrive, then processes them
+    void poll(std::chrono::milliseconds timeout);
+
+    // Services known to this subscriber, as of the last poll()
+    std::vector<ServicePtr> services() const;
+
+    // Queue counters, safe to call from any thread
+    Statistics statistics() const;
+
+    // File descriptor which becomes readable when poll() has work to do
+    int nativeHandle() const;
+
+    // Stops receiving changes, the services stay as they are
+    void detach();
+
+    // Callbacks, emitted from poll()
+	Connection connectServiceAdded(const std::function<void(ServicePtr)> handler)
+    { return _serviceAdded.connect(handler); }
+
+	Connection connectServiceUpdated(const std::function<void(ServicePtr)> handler)
+    { return _serviceUpdated.connect(handler); }
+
+	Connection connectServiceRemoved(const std::function<void(ServicePtr)> handler)
+    { return _serviceRemoved.connect(handler); }
+
+	Connection connectError(const std::function<void(Browser::Error)> handler)
+    { return _error.connect(handler); }
+
+private:
+
+    class Feed;
+    std::shared_ptr<Feed> _feed;
+    ScopedConnection      _connection;
+
+    // Service identity (see Feed::identity) -> copy owned by this subscriber.
+    // Not the browser's pointer, the memory of a removed service is reused.
+    std::unordered_map<std::string, ServicePtr> _services;
+    size_t                _lost = 0;
+
+	Signal<ServicePtr>	    _serviceAdded;
+	Signal<ServicePtr>	    _serviceUpdated;
+	Signal<ServicePtr>	    _serviceRemoved;
+	Signal<Browser::Error>  _error;
+};
+
+}
@@ -0,0 +1,121 @@
+// Copyright (c) 2017  Mathias Roder (teuse@mailbox.org)
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+
+namespace zeroconf {
+
+//------------------------------------------------------------------------------
+
+// The TXT record of a service, kept as received: one buffer in DNS wire format,
+// a length byte before each "key=value" string. An index of offsets into the
+// buffer is built once, lookups compare keys in place and hand out views into
+// the buffer without allocating. Keys are case insensitive, the first of
+// several equal keys wins (RFC 6763, 6.4).
+
+class TxtRecord
+{
+public:
+
+    TxtRecord() = default;
+
+    // Copies and indexes a record in wire format. Malformed trailing bytes
+    // are left out.
+    explicit TxtRecord(std::string_view wire)
+    : _data(wire)
+    {
+        for (size_t i = 0; i < _data.size(); )
+        {
+            auto length = static_cast<uint8_t>(_data[i++]);
+            if (length == 0) continue;
+            if (i + length > std::min(_data.size(), size_t(UINT16_MAX))) { _data.resize(i - 1); break; }
+
+            auto entry = std::string_view(&_data[i], length);
+            auto equal = entry.find('=');
+            _index.push_back({static_cast<uint16_t>(i), static_cast<uint8_t>(std::min(equal, entry.size())), length});
+            i += length;
+        }
+    }
+
+    // The record in wire format, as sent on the network
+    const std::string& data() const { return _data; }
+
+    bool   empty() const { return _index.empty(); }
+    size_t size()  const { return _index.size();  }
+
+    std::string_view key(size_t i) const   { return {&_data[_index[i].offset], _index[i].key}; }
+
+    // Empty for boolean attributes, present without "="
+    std::string_view value(size_t i) const
+    {
+        const auto& e = _index[i];
+        if (e.key == e.length) return {};
+        return {&_data[e.offset + e.key + 1], size_t(e.length - e.key - 1)};
+    }
+
+    // The value of key, nullopt if the key isn't there
+    std::optional<std::string_view> find(std::string_view key) const
+    {
+        for (size_t i = 0; i < _index.size(); ++i)
+            if (equal(this->key(i), key)) return value(i);
+        return std::nullopt;
+    }
+
+    bool contains(std::string_view key) const { return find(key).has_value(); }
+
+    // The value of key, fallback if the key isn't there
+    std::string_view value(std::string_view key, std::string_view fallback = {}) const
+    {
+        auto v = find(key);
+        return v ? *v : fallback;
+    }
+
+    friend bool operator==(const TxtRecord& a, const TxtRecord& b) { return a._data == b._data; }
+    friend bool operator!=(const TxtRecord& a, const TxtRecord& b) { return a._data != b._data; }
+
+private:
+
+    static bool equal(std::string_view a, std::string_view b)
+    {
+        if (a.size() != b.size()) return false;
+        for (size_t i = 0; i < a.size(); ++i)
+            if (lower(a[i]) != lower(b[i])) return false;
+        return true;
+    }
+
+    // Keys are printable US-ASCII, no locale involved
+    static char lower(char c) { return (c >= 'A' && c <= 'Z') ? char(c - 'A' + 'a') : c; }
+
+    // One "key=value" string: where it starts, the length of the key and of
+    // the whole string. A TXT record is at most 65535 bytes.
+    struct Entry
+    {
+        uint16_t offset;
+        uint8_t  key;
+        uint8_t  length;
+    };
+
+    std::string         _data;
+    std::vector<Entry>  _index;
+};
+
+}
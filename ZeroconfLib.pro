@@ -6,7 +6,7 @@
 
 TEMPLATE = lib
 
-CONFIG += c++14 \
+CONFIG += c++17 \
           staticlib
 
 # ------------------------------------------------------------------------------
@@ -16,21 +16,27 @@ CONFIG += c++14 \
 INCLUDEPATH += $$_PRO_FILE_PWD_ 
 
 HEADERS += Zeroconf/Service.h \
+           Zeroconf/Context.h \
+           Zeroconf/Context_bonjour.h \
+           Zeroconf/EventQueue.h \
+           Zeroconf/MonitorList.h \
+           Zeroconf/Notifier.h \
+           Zeroconf/ResolveBacklog.h \
+           Zeroconf/Signal.h \
+           Zeroconf/TxtRecord.h \
            Zeroconf/Publisher.h \
-           Zeroconf/Browser.h
-
-SOURCES += Zeroconf/Browser_bonjour.cpp \
-           Zeroconf/Publisher_bonjour.cpp
+           Zeroconf/Browser.h \
+           Zeroconf/Subscriber.h
+
+SOURCES += Zeroconf/Browser.cpp \
+           Zeroconf/Browser_bonjour.cpp \
+           Zeroconf/Context.cpp \
+           Zeroconf/Context_bonjour.cpp \
+           Zeroconf/Publisher_bonjour.cpp \
+           Zeroconf/Subscriber.cpp
             
 
 # ------------------------------------------------------------------------------
 # --- Dependencies
 # ------------------------------------------------------------------------------
-BOOST_ROOT = $$_PRO_FILE_PWD_/../../../boost-ios/build/boost/1.64.0/ios/prefix
-isEmpty(BOOST_ROOT){
-    error("ZeroconfLib: BOOST_ROOT for ios is not defined")
-}
-
-INCLUDEPATH += $$BOOST_ROOT/include
-
 LIBS += -framework CoreServices 
@@ -7,10 +7,14 @@
 # AVAHI_FOUND - system has avahi
 # AVAHI_INCLUDE_DIRS - the avahi include directory
 # AVAHI_LIBRARIES - The avahi libraries
+# AVAHI_CORE_INCLUDE_DIRS - the avahi-core include directory, if found
+# AVAHI_CORE_LIBRARIES - avahi-core with avahi-common, if found
 
 if(PKG_CONFIG_FOUND)
   pkg_check_modules (AVAHI avahi-client)
   list(APPEND AVAHI_INCLUDE_DIRS ${AVAHI_INCLUDEDIR})
+  pkg_check_modules (AVAHI_CORE avahi-core)
+  list(APPEND AVAHI_CORE_INCLUDE_DIRS ${AVAHI_CORE_INCLUDEDIR})
 else()
   find_path(AVAHI_CLIENT_INCLUDE_DIRS avahi-client/client.h)
   find_path(AVAHI_COMMON_INCLUDE_DIRS avahi-common/defs.h)
@@ -20,10 +24,17 @@ else()
                          ${AVAHI_COMMON_INCLUDE_DIRS})
   set(AVAHI_LIBRARIES ${AVAHI_CLIENT_LIBRARIES}
                       ${AVAHI_COMMON_LIBRARIES})
+
+  find_path(AVAHI_CORE_INCLUDE_DIRS avahi-core/core.h)
+  find_library(AVAHI_CORE_LIBRARY avahi-core)
+  if(AVAHI_CORE_LIBRARY)
+    set(AVAHI_CORE_LIBRARIES ${AVAHI_CORE_LIBRARY}
+                             ${AVAHI_COMMON_LIBRARIES})
+  endif()
 endif()
 
 include(FindPackageHandleStandardArgs)
 find_package_handle_standard_args(Avahi DEFAULT_MSG AVAHI_INCLUDE_DIRS AVAHI_LIBRARIES)
 
-mark_as_advanced(AVAHI_INCLUDE_DIRS AVAHI_LIBRARIES)
+mark_as_advanced(AVAHI_INCLUDE_DIRS AVAHI_LIBRARIES AVAHI_CORE_INCLUDE_DIRS AVAHI_CORE_LIBRARIES)
 list(APPEND AVAHI_DEFINITIONS -DHAVE_LIBAVAHI_COMMON=1 -DHAVE_LIBAVAHI_CLIENT=1)
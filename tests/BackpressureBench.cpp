@@ -0,0 +1,84 @@
+#include "Bench.h"
+#include "StandIn.h"
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace zeroconf;
+
+//------------------------------------------------------------------------------
+
+namespace {
+
+const size_t SERVICES = 2000;
+const size_t REPLIES  = 100000;
+const size_t CAPACITY = 1000;
+
+const char* TYPE = "_http._tcp";
+
+// The daemon floods a bounded queue with port changes faster than a slow
+// handler polls them. Reports what each policy lost and whether the services
+// end up in their final state.
+void flood(const char* name, Backpressure policy)
+{
+    auto options          = Browser::Options();
+    options.queueCapacity = CAPACITY;
+    options.backpressure  = policy;
+    Browser browser(options);
+    browser.start(TYPE);
+
+    browser.connectServiceUpdated([] (ServicePtr) {
+        auto until = bench::Clock::now() + std::chrono::microseconds(2);
+        while (bench::Clock::now() < until) {}
+    });
+
+    std::vector<uint16_t> last(SERVICES);
+    std::atomic<bool> done = {false};
+
+    auto s = bench::seconds([&] {
+        std::thread daemon([&] {
+            for (size_t i = 0; i < REPLIES; ++i)
+            {
+                auto service = i % SERVICES;
+                last[service] = uint16_t(i / SERVICES + 1);
+                standin::Daemon::send({standin::Reply::FOUND, "Service " + std::to_string(service), TYPE,
+                                       "host.local", "10.0.0.1", last[service]});
+            }
+            done = true;
+        });
+
+        while (!done.load() || browser.statistics().queued)
+            browser.poll(std::chrono::milliseconds(10));
+        daemon.join();
+    });
+
+    size_t stale = 0;
+    for (const auto& service : browser.services())
+    {
+        auto i = std::stoul(service->name.substr(service->name.find(' ') + 1));
+        if (service->port != last[i]) ++stale;
+    }
+    stale += SERVICES - browser.services().size();
+
+    auto stats = browser.statistics();
+    bench::report(name, REPLIES, s);
+    std::printf("%-40s %10zu dropped, %zu coalesced, %zu of %zu services stale\n", "",
+                stats.dropped, stats.coalesced, stale, SERVICES);
+}
+
+}
+
+//------------------------------------------------------------------------------
+
+int main()
+{
+    std::printf("%zu replies for %zu services into a queue of %zu, slow handler\n", REPLIES, SERVICES, CAPACITY);
+    flood("BACKPRESSURE_DROP_NEWEST", BACKPRESSURE_DROP_NEWEST);
+    flood("BACKPRESSURE_DROP_OLDEST", BACKPRESSURE_DROP_OLDEST);
+    flood("BACKPRESSURE_BLOCK",       BACKPRESSURE_BLOCK);
+    flood("BACKPRESSURE_COALESCE",    BACKPRESSURE_COALESCE);
+
+    return 0;
+}
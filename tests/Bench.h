@@ -0,0 +1,43 @@
+// Copyright (c) 2017  Mathias Roder (teuse@mailbox.org)
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+#include <chrono>
+#include <cstdio>
+
+
+// Minimal helpers for the benchmarks, which like the tests need nothing but
+// the headers under test. They print one line per measurement and aren't run
+// by ctest. Numbers of a Release build only mean something.
+
+namespace bench {
+
+using Clock = std::chrono::steady_clock;
+
+// Wall time of f in seconds
+template <typename F>
+double seconds(F&& f)
+{
+    auto start = Clock::now();
+    f();
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+inline void report(const char* name, size_t count, double seconds)
+{
+    std::printf("%-40s %10zu in %8.2f ms, %8.1f ns each\n", name, count, seconds * 1e3,
+                count ? seconds * 1e9 / double(count) : 0.0);
+}
+
+}
@@ -0,0 +1,92 @@
+#include "Bench.h"
+#include "StandIn.h"
+
+#include <string>
+
+using namespace zeroconf;
+
+//------------------------------------------------------------------------------
+
+namespace {
+
+const size_t SERVICES = 10000;
+const size_t DRAIN    = 1000;   // replies between two polls
+
+const char* TYPE = "_http._tcp";
+
+// 10k services come up, flap their port twice, and a third of them goes away
+// again. The replies of a service are spread over the trace, as a network
+// churns, so most of them share a drain with others of the same service.
+template <typename Poll>
+size_t replay(Poll&& poll)
+{
+    auto name = [] (size_t i) { return "Service " + std::to_string(i); };
+    auto send = [&] (standin::Reply::Kind kind, size_t i, uint16_t port) {
+        standin::Daemon::send({kind, name(i), TYPE, "host-" + std::to_string(i) + ".local", "10.0.0.1", port});
+    };
+
+    size_t replies = 0;
+    auto next = [&] {
+        if (++replies % DRAIN == 0) poll();
+    };
+
+    for (size_t i = 0; i < SERVICES; ++i)
+    {
+        send(standin::Reply::FOUND, i, 80);                      next();
+        if (i >= 10) { send(standin::Reply::FOUND, i - 10, 81);  next(); }
+        if (i >= 20) { send(standin::Reply::FOUND, i - 20, 82);  next(); }
+        if (i >= 30 && (i - 30) % 3 == 0) { send(standin::Reply::GONE, i - 30, 0); next(); }
+    }
+    poll();
+    return replies;
+}
+
+void signals()
+{
+    Browser browser;
+    browser.start(TYPE);
+
+    size_t calls = 0;
+    browser.connectServiceAdded([&] (ServicePtr)   { ++calls; });
+    browser.connectServiceUpdated([&] (ServicePtr) { ++calls; });
+    browser.connectServiceRemoved([&] (ServicePtr) { ++calls; });
+
+    size_t replies = 0;
+    auto s = bench::seconds([&] { replies = replay([&] { browser.poll(); }); });
+    bench::report("poll(), signals", replies, s);
+    std::printf("%-40s %10zu handler invocations, %zu services left\n", "", calls, browser.services().size());
+}
+
+void changeSets()
+{
+    Browser browser;
+    browser.start(TYPE);
+
+    size_t calls = 0;
+    auto handle = [&] (ServicePtr) { ++calls; };
+
+    size_t replies = 0;
+    auto s = bench::seconds([&] {
+        replies = replay([&] {
+            auto changes = browser.pollBatch();
+            for (auto& c : changes.added)   handle(c);
+            for (auto& c : changes.updated) handle(c);
+            for (auto& c : changes.removed) handle(c);
+        });
+    });
+    bench::report("pollBatch(), change sets", replies, s);
+    std::printf("%-40s %10zu handler invocations, %zu services left\n", "", calls, browser.services().size());
+}
+
+}
+
+//------------------------------------------------------------------------------
+
+int main()
+{
+    std::printf("Churn of %zu services, a poll every %zu replies\n", SERVICES, DRAIN);
+    signals();
+    changeSets();
+
+    return 0;
+}
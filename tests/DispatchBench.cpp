@@ -0,0 +1,84 @@
+#include "Bench.h"
+#include "StandIn.h"
+
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace zeroconf;
+
+//------------------------------------------------------------------------------
+
+namespace {
+
+const size_t COUNT = 5000;
+
+const char* TYPE = "_http._tcp";
+
+// Time from the daemon thread sending a reply to serviceAdded seeing it. The
+// daemon paces its replies, the queued browser is polled by a thread waiting
+// in poll(timeout) like an application would.
+void latency(const char* name, Dispatch dispatch)
+{
+    auto options     = Browser::Options();
+    options.dispatch = dispatch;
+    Browser browser(options);
+    browser.start(TYPE);
+
+    std::vector<bench::Clock::time_point> sent(COUNT);
+    std::vector<double>                   latencies;
+    latencies.reserve(COUNT);
+    std::atomic<size_t> seen = {0};
+
+    // The port carries the index of the reply
+    browser.connectServiceAdded([&] (ServicePtr s) {
+        latencies.push_back(std::chrono::duration<double, std::micro>(bench::Clock::now() - sent[s->port]).count());
+        ++seen;
+    });
+
+    std::thread poller;
+    if (dispatch == DISPATCH_QUEUED)
+    {
+        poller = std::thread([&] {
+            while (seen.load() < COUNT)
+                browser.poll(std::chrono::milliseconds(100));
+        });
+    }
+
+    for (size_t i = 0; i < COUNT; ++i)
+    {
+        sent[i] = bench::Clock::now();
+        standin::Daemon::send({standin::Reply::FOUND, "Service " + std::to_string(i), TYPE, "host.local", "10.0.0.1", uint16_t(i)});
+        std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+    if (poller.joinable()) poller.join();
+
+    std::sort(latencies.begin(), latencies.end());
+    auto at = [&] (double q) { return latencies[size_t(q * double(latencies.size() - 1))]; };
+    std::printf("%-40s p50 %8.1f us, p99 %8.1f us, max %8.1f us\n", name, at(0.5), at(0.99), latencies.back());
+
+    const double bounds[] = {1, 10, 100, 1000, 10000};
+    size_t lower = 0;
+    for (auto b : bounds)
+    {
+        auto upper = size_t(std::lower_bound(latencies.begin(), latencies.end(), b) - latencies.begin());
+        std::printf("%-40s %10s %6.0f us: %zu\n", "", "<", b, upper - lower);
+        lower = upper;
+    }
+    std::printf("%-40s %10s %6.0f us: %zu\n", "", ">=", bounds[4], latencies.size() - lower);
+}
+
+}
+
+//------------------------------------------------------------------------------
+
+int main()
+{
+    std::printf("Latency of %zu replies, daemon thread to serviceAdded\n", COUNT);
+    latency("DISPATCH_QUEUED, poll(timeout)", DISPATCH_QUEUED);
+    latency("DISPATCH_DIRECT", DISPATCH_DIRECT);
+
+    return 0;
+}
@@ -0,0 +1,164 @@
+#include "Bench.h"
+
+#include <Zeroconf/EventQueue.h>
+
+#include <atomic>
+#include <cstdlib>
+#include <functional>
+#include <new>
+#include <string>
+#include <vector>
+
+using namespace zeroconf;
+
+//------------------------------------------------------------------------------
+
+// Counts every allocation of the process
+namespace {
+std::atomic<size_t> allocations = {0};
+}
+
+void* operator new(size_t size)
+{
+    ++allocations;
+    if (auto* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept              { std::free(p); }
+void operator delete(void* p, size_t) noexcept      { std::free(p); }
+
+//------------------------------------------------------------------------------
+
+namespace {
+
+const size_t SERVICES = 100000;
+
+// One discovered service is a browse reply and a resolve reply, with strings
+// of a typical length, beyond the small string buffer of std::string
+const std::string NAME    = "Living Room Speaker [a1:b2:c3:d4:e5:f6]";
+const std::string TYPE    = "_googlecast._tcp";
+const std::string DOMAIN  = "local";
+const std::string HOST    = "living-room-speaker-a1b2c3.local";
+const std::string ADDRESS = "fe80::a1b2:c3ff:fed4:e5f6";
+const std::string TXT     = "\x09id=a1b2c3\x0b" "fn=Speaker\x05" "ve=05";
+
+// The typed event of the backends, its strings live in the queue's arena
+struct Event
+{
+    int      kind      = 0;
+    int      interface = 0;
+    int      protocol  = 0;
+    uint16_t port      = 0;
+    char     address[16] = {};
+    Text     name;
+    Text     type;
+    Text     domain;
+    Text     host;
+    Text     txt;
+};
+
+void typedEvents()
+{
+    EventQueue<Event> queue;
+    size_t handled = 0;
+
+    auto browse = [&] (size_t i) {
+        queue.emplace(NAME.size() + TYPE.size() + DOMAIN.size(), [&] (Event& e, EventQueue<Event>::Arena& a) {
+            e.kind      = 0;
+            e.interface = int(i);
+            e.name      = a.copy(NAME);
+            e.type      = a.copy(TYPE);
+            e.domain    = a.copy(DOMAIN);
+        });
+    };
+    auto resolve = [&] (size_t i) {
+        auto bytes = NAME.size() + TYPE.size() + DOMAIN.size() + HOST.size() + TXT.size();
+        queue.emplace(bytes, [&] (Event& e, EventQueue<Event>::Arena& a) {
+            e.kind      = 1;
+            e.interface = int(i);
+            e.port      = 8009;
+            e.name      = a.copy(NAME);
+            e.type      = a.copy(TYPE);
+            e.domain    = a.copy(DOMAIN);
+            e.host      = a.copy(HOST);
+            e.txt       = a.copy(TXT);
+        });
+    };
+
+    // Warmed up, the segments of the largest burst are pooled from then on
+    for (size_t i = 0; i < 10; ++i) { browse(i); resolve(i); }
+    queue.consume_all([&] (const Event&) {});
+
+    auto before = allocations.load();
+    auto s = bench::seconds([&] {
+        for (size_t i = 0; i < SERVICES; ++i)
+        {
+            browse(i);
+            resolve(i);
+            if (i % 10 == 9) queue.consume_all([&] (const Event& e) { handled += e.name.size; });
+        }
+    });
+    auto count = allocations.load() - before;
+
+    bench::report("typed events", SERVICES, s);
+    std::printf("%-40s %10.2f allocations per service\n", "", double(count) / SERVICES);
+}
+
+// The closures the library queued before, capturing std::strings. The ring of
+// 20 slots preallocates them like spsc_queue did.
+void closures()
+{
+    std::vector<std::function<void()>> queue;
+    queue.reserve(20);
+    size_t handled = 0;
+
+    auto browse = [&] (size_t i) {
+        auto n = std::string(NAME.c_str());
+        auto t = std::string(TYPE.c_str());
+        auto d = std::string(DOMAIN.c_str());
+        auto interface = int(i);
+        queue.push_back([=, &handled] { handled += n.size() + t.size() + d.size() + interface; });
+    };
+    auto resolve = [&] (size_t i) {
+        auto n  = std::string(NAME.c_str());
+        auto t  = std::string(TYPE.c_str());
+        auto d  = std::string(DOMAIN.c_str());
+        auto h  = std::string(HOST.c_str());
+        auto ad = std::string(ADDRESS.c_str());
+        auto interface = int(i);
+        uint16_t port  = 8009;
+        queue.push_back([=, &handled] { handled += n.size() + t.size() + d.size() + h.size() + ad.size() + interface + port; });
+    };
+    auto consume = [&] {
+        for (const auto& f : queue) f();
+        queue.clear();
+    };
+
+    auto before = allocations.load();
+    auto s = bench::seconds([&] {
+        for (size_t i = 0; i < SERVICES; ++i)
+        {
+            browse(i);
+            resolve(i);
+            if (i % 10 == 9) consume();
+        }
+    });
+    auto count = allocations.load() - before;
+
+    bench::report("std::function closures", SERVICES, s);
+    std::printf("%-40s %10.2f allocations per service\n", "", double(count) / SERVICES);
+}
+
+}
+
+//------------------------------------------------------------------------------
+
+int main()
+{
+    std::printf("%zu discovered services, a browse and a resolve event each\n", SERVICES);
+    typedEvents();
+    closures();
+
+    return 0;
+}
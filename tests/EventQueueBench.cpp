@@ -0,0 +1,144 @@
+#include "Bench.h"
+
+#include <Zeroconf/EventQueue.h>
+
+#ifdef BENCH_BOOST
+#include <boost/lockfree/spsc_queue.hpp>
+#endif
+
+#include <atomic>
+#include <functional>
+#include <string>
+#include <thread>
+
+using namespace zeroconf;
+
+//------------------------------------------------------------------------------
+
+namespace {
+
+const size_t COUNT = 1000000;
+
+// Shaped like a browse event of the backends
+struct Event
+{
+    int  kind      = 0;
+    int  interface = 0;
+    Text name;
+    Text type;
+    Text domain;
+};
+
+const std::string NAME   = "Living Room Speaker";
+const std::string TYPE   = "_http._tcp";
+const std::string DOMAIN = "local";
+
+// The producer stands in for the Avahi thread, the consumer for a poll() loop
+void eventQueue(const char* name, bool concurrent)
+{
+    EventQueue<Event> queue;
+    std::atomic<size_t> seen = {0};
+
+    auto produce = [&] {
+        for (size_t i = 0; i < COUNT; ++i)
+        {
+            queue.emplace(NAME.size() + TYPE.size() + DOMAIN.size(), [&] (Event& e, EventQueue<Event>::Arena& a) {
+                e.kind      = 1;
+                e.interface = int(i);
+                e.name      = a.copy(NAME);
+                e.type      = a.copy(TYPE);
+                e.domain    = a.copy(DOMAIN);
+            });
+        }
+    };
+    auto consume = [&] {
+        while (seen.load() + queue.dropped() < COUNT)
+        {
+            queue.wait(std::chrono::milliseconds(100));
+            seen += queue.consume_all([] (const Event& e) { (void)e.name.size; });
+        }
+    };
+
+    auto s = bench::seconds([&] {
+        if (concurrent)
+        {
+            std::thread producer(produce);
+            consume();
+            producer.join();
+        }
+        else
+        {
+            produce();
+            consume();
+        }
+    });
+    bench::report(name, COUNT, s);
+    std::printf("%-40s %10zu delivered, %zu dropped, high water %zu\n", "", seen.load(), queue.dropped(), queue.highWater());
+}
+
+#ifdef BENCH_BOOST
+// The queue the library used before, 20 slots of closures, lost events when full
+void spscQueue(const char* name, bool concurrent)
+{
+    boost::lockfree::spsc_queue<std::function<void()>> queue(20);
+    std::atomic<size_t> seen = {0}, lost = {0};
+    std::atomic<bool>   done = {false};
+
+    auto produce = [&] {
+        for (size_t i = 0; i < COUNT; ++i)
+        {
+            auto n = NAME, t = TYPE, d = DOMAIN;
+            auto interface = int(i);
+            if (!queue.push([=, &seen] { (void)n.size(); (void)t.size(); (void)d.size(); (void)interface; ++seen; }))
+                ++lost;
+        }
+        done = true;
+    };
+    auto consume = [&] {
+        for (;;)
+        {
+            auto finished = done.load();
+            queue.consume_all([] (const std::function<void()>& f) { f(); });
+            if (finished) break;
+            std::this_thread::yield();
+        }
+    };
+
+    auto s = bench::seconds([&] {
+        if (concurrent)
+        {
+            std::thread producer(produce);
+            consume();
+            producer.join();
+        }
+        else
+        {
+            produce();
+            consume();
+        }
+    });
+    bench::report(name, COUNT, s);
+    std::printf("%-40s %10zu delivered, %zu dropped\n", "", seen.load(), lost.load());
+}
+#endif
+
+}
+
+//------------------------------------------------------------------------------
+
+int main()
+{
+    std::printf("%zu events from a producer thread to a consumer\n", COUNT);
+    eventQueue("EventQueue, concurrent", true);
+#ifdef BENCH_BOOST
+    spscQueue("spsc_queue(20), concurrent", true);
+#endif
+
+    std::printf("\n%zu events as one burst, consumed afterwards\n", COUNT);
+    eventQueue("EventQueue, burst", false);
+#ifdef BENCH_BOOST
+    spscQueue("spsc_queue(20), burst", false);
+#endif
+
+    return 0;
+}
@@ -0,0 +1,352 @@
+#include "Check.h"
+
+#include <Zeroconf/EventQueue.h>
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using namespace zeroconf;
+
+//------------------------------------------------------------------------------
+
+namespace {
+
+struct Event
+{
+    int  id = 0;
+    Text text;
+};
+
+// Small segments and arenas, so a few events cross segment boundaries
+using SmallQueue = EventQueue<int, 4, 64>;
+using TextQueue  = EventQueue<Event, 4, 16>;
+
+std::vector<int> consume(SmallQueue& queue)
+{
+    std::vector<int> events;
+    queue.consume_all([&] (const int& e) { events.push_back(e); });
+    return events;
+}
+
+std::vector<int> range(int first, int last)
+{
+    std::vector<int> v;
+    for (int i = first; i < last; ++i) v.push_back(i);
+    return v;
+}
+
+//------------------------------------------------------------------------------
+
+void testWrapAround()
+{
+    SmallQueue queue;
+
+    // A burst links segments, the next rounds reuse them from the pool
+    for (int round = 0; round < 5; ++round)
+    {
+        for (int i = 0; i < 10; ++i) CHECK(queue.push(round * 10 + i));
+        CHECK(queue.size() == 10);
+        CHECK(consume(queue) == range(round * 10, round * 10 + 10));
+        CHECK(queue.empty());
+    }
+
+    // Producer and consumer taking turns across segment boundaries
+    int next = 0, expected = 0;
+    for (int round = 0; round < 20; ++round)
+    {
+        for (int i = 0; i < 3; ++i) queue.push(next++);
+        for (auto e : consume(queue)) CHECK(e == expected++);
+    }
+    CHECK(expected == next);
+    CHECK(queue.dropped() == 0);
+    CHECK(queue.highWater() == 10);
+}
+
+void testArena()
+{
+    TextQueue queue;
+
+    // Every other event fills an arena and moves on to the next segment
+    const std::string texts[] = {"0123456789", "abcdefghij", "", "xyz", "ABCDEFGHIJKLMNOP"};
+    int id = 0;
+    for (const auto& t : texts)
+    {
+        CHECK(queue.emplace(t.size(), [&] (Event& e, TextQueue::Arena& a) {
+            e.id   = id++;
+            e.text = a.copy(t);
+        }));
+    }
+
+    std::vector<std::string> seen;
+    queue.consume_all([&] (const Event& e) {
+        CHECK(e.id == int(seen.size()));
+        seen.push_back(e.text.str());
+    });
+    CHECK(seen == std::vector<std::string>(std::begin(texts), std::end(texts)));
+
+    // Strings bigger than an arena can't be queued
+    CHECK(!queue.emplace(17, [] (Event&, TextQueue::Arena&) {}));
+    CHECK(queue.dropped() == 1);
+    CHECK(queue.empty());
+}
+
+void testHoldPublish()
+{
+    SmallQueue queue;
+
+    queue.hold();
+    queue.push(0);
+    queue.push(1);
+    queue.push(2);
+
+    // Staged events are neither visible nor signalled
+    CHECK(queue.empty());
+    CHECK(!queue.wait(std::chrono::milliseconds(0)));
+    CHECK(consume(queue).empty());
+
+    queue.publish();
+    CHECK(queue.size() == 3);
+    CHECK(queue.wait(std::chrono::milliseconds(0)));
+    CHECK(consume(queue) == range(0, 3));
+
+    // A segment which fills up while held is published on its own
+    SmallQueue burst;
+    burst.hold();
+    for (int i = 0; i < 6; ++i) burst.push(int(i));
+    CHECK(consume(burst) == range(0, 4));
+
+    burst.publish();
+    CHECK(consume(burst) == range(4, 6));
+}
+
+//------------------------------------------------------------------------------
+
+void testDropNewest()
+{
+    SmallQueue queue(3, BACKPRESSURE_DROP_NEWEST);
+
+    for (int i = 0; i < 5; ++i) queue.push(int(i));
+    CHECK(queue.dropped() == 2);
+    CHECK(consume(queue) == range(0, 3));
+
+    // Room again once consumed
+    CHECK(queue.push(5));
+    CHECK(consume(queue) == std::vector<int>{5});
+}
+
+void testDropOldest()
+{
+    SmallQueue queue(3, BACKPRESSURE_DROP_OLDEST);
+
+    for (int i = 0; i < 10; ++i) queue.push(int(i));
+    CHECK(queue.dropped() == 7);
+    CHECK(consume(queue) == range(7, 10));
+}
+
+void testBlock()
+{
+    // Nobody consumes, the producer gives up after blockTimeout
+    {
+        SmallQueue queue(2, BACKPRESSURE_BLOCK, {}, {}, std::chrono::milliseconds(10));
+        CHECK(queue.push(0));
+        CHECK(queue.push(1));
+        CHECK(!queue.push(2));
+        CHECK(queue.dropped() == 1);
+        CHECK(consume(queue) == range(0, 2));
+    }
+
+    // A consumer makes room, nothing is lost
+    {
+        SmallQueue queue(2, BACKPRESSURE_BLOCK, {}, {}, std::chrono::seconds(10));
+
+        const int count = 1000;
+        std::vector<int> seen;
+        std::thread consumer([&] {
+            while (int(seen.size()) < count)
+            {
+                queue.wait(std::chrono::milliseconds(100));
+                queue.consume_all([&] (const int& e) { seen.push_back(e); });
+            }
+        });
+
+        for (int i = 0; i < count; ++i) queue.push(int(i));
+        consumer.join();
+
+        CHECK(queue.dropped() == 0);
+        CHECK(queue.highWater() <= 2);
+        CHECK(seen == range(0, count));
+    }
+}
+
+void testCoalesce()
+{
+    using Pair  = std::pair<int, int>;  // (key, value)
+    using Queue = EventQueue<Pair, 4, 64>;
+
+    Queue queue(2, BACKPRESSURE_COALESCE, [] (const Pair& p) { return std::to_string(p.first); });
+
+    queue.push({1, 0});
+    queue.push({2, 0});
+
+    // Beyond capacity the latest event per key is kept, in the order of the
+    // latest events
+    queue.push({1, 1});
+    queue.push({2, 1});
+    queue.push({1, 2});
+    CHECK(queue.size() == 4);
+    CHECK(queue.coalesced() == 1);
+    CHECK(queue.dropped() == 0);
+
+    std::vector<Pair> seen;
+    queue.consume_all([&] (const Pair& p) { seen.push_back(p); });
+    CHECK((seen == std::vector<Pair>{{1, 0}, {2, 0}, {2, 1}, {1, 2}}));
+    CHECK(queue.empty());
+
+    // Back to the queue once the overflow is taken
+    queue.push({3, 0});
+    seen.clear();
+    queue.consume_all([&] (const Pair& p) { seen.push_back(p); });
+    CHECK((seen == std::vector<Pair>{{3, 0}}));
+}
+
+void testKeep()
+{
+    auto keep = [] (const int& e) { return e >= 100; };
+
+    // Kept events go beyond capacity under every dropping policy
+    for (auto policy : {BACKPRESSURE_DROP_NEWEST, BACKPRESSURE_DROP_OLDEST, BACKPRESSURE_BLOCK})
+    {
+        SmallQueue queue(2, policy, {}, keep, std::chrono::milliseconds(10));
+        queue.push(0);
+        queue.push(1);
+        CHECK(queue.push(100));
+        CHECK(queue.push(101));
+        CHECK(queue.size() == 4);
+        CHECK(queue.dropped() == 0);
+        CHECK((consume(queue) == std::vector<int>{0, 1, 100, 101}));
+    }
+
+    // DROP_OLDEST drops the newest one while the oldest is to be kept
+    {
+        SmallQueue queue(2, BACKPRESSURE_DROP_OLDEST, {}, keep);
+        queue.push(100);
+        queue.push(1);
+        CHECK(!queue.push(2));
+        CHECK(queue.dropped() == 1);
+        CHECK((consume(queue) == std::vector<int>{100, 1}));
+    }
+}
+
+void testTake()
+{
+    // Strings of taken events stay valid across segments until taken()
+    {
+        TextQueue queue;
+        const std::string texts[] = {"0123456789", "abcdefghij", "xyz", "ABCDEFGHIJKLMNOP"};
+        for (const auto& t : texts)
+            queue.emplace(t.size(), [&] (Event& e, TextQueue::Arena& a) { e.text = a.copy(t); });
+
+        std::vector<Event> events;
+        CHECK(queue.take(events) == 4);
+        CHECK(queue.empty());
+
+        // Nested takes keep the outer strings too
+        queue.emplace(3, [] (Event& e, TextQueue::Arena& a) { e.text = a.copy("uvw"); });
+        CHECK(queue.take(events) == 1);
+        queue.taken();
+
+        std::vector<std::string> seen;
+        for (const auto& e : events) seen.push_back(e.text.str());
+        CHECK((seen == std::vector<std::string>{"0123456789", "abcdefghij", "xyz", "ABCDEFGHIJKLMNOP", "uvw"}));
+        queue.taken();
+    }
+
+    // A producer blocked on a full queue goes on once the events are taken,
+    // and doesn't block until they are handled
+    {
+        SmallQueue queue(2, BACKPRESSURE_BLOCK, {}, {}, std::chrono::seconds(10));
+        queue.push(0);
+        queue.push(1);
+
+        std::thread producer([&] {
+            for (int i = 2; i < 8; ++i) queue.push(int(i));
+        });
+
+        std::vector<int> events;
+        queue.take(events);
+        producer.join();
+        queue.take(events);
+        queue.taken();
+        queue.taken();
+
+        CHECK(queue.dropped() == 0);
+        CHECK(events == range(0, 8));
+    }
+
+    // The overflow comes after the queue, as with consume_all()
+    {
+        using Pair  = std::pair<int, int>;
+        using Queue = EventQueue<Pair, 4, 64>;
+
+        Queue queue(2, BACKPRESSURE_COALESCE, [] (const Pair& p) { return std::to_string(p.first); });
+        for (auto p : std::vector<Pair>{{1, 0}, {2, 0}, {1, 1}, {2, 1}, {1, 2}})
+            queue.push(Pair(p));
+
+        std::vector<Pair> events;
+        CHECK(queue.take(events) == 4);
+        queue.taken();
+        CHECK((events == std::vector<Pair>{{1, 0}, {2, 0}, {2, 1}, {1, 2}}));
+
+        queue.push({3, 0});
+        events.clear();
+        queue.take(events);
+        queue.taken();
+        CHECK((events == std::vector<Pair>{{3, 0}}));
+    }
+}
+
+//------------------------------------------------------------------------------
+
+void testNotifier()
+{
+    SmallQueue queue;
+    CHECK(!queue.wait(std::chrono::milliseconds(0)));
+
+    // Woken from another thread once an event arrives
+    std::thread producer([&] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        queue.push(0);
+    });
+    CHECK(queue.wait(std::chrono::seconds(10)));
+    producer.join();
+    CHECK(consume(queue) == range(0, 1));
+
+    // Woken without an event, until the consumer looks at the queue
+    queue.wake();
+    CHECK(queue.wait(std::chrono::milliseconds(0)));
+    CHECK(consume(queue).empty());
+    CHECK(!queue.wait(std::chrono::milliseconds(0)));
+}
+
+}
+
+//------------------------------------------------------------------------------
+
+int main()
+{
+    testWrapAround();
+    testArena();
+    testHoldPublish();
+    testDropNewest();
+    testDropOldest();
+    testBlock();
+    testCoalesce();
+    testKeep();
+    testTake();
+    testNotifier();
+
+    return test::result();
+}
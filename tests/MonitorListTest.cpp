@@ -0,0 +1,79 @@
+#include "Check.h"
+
+#include <Zeroconf/MonitorList.h>
+
+#include <string>
+
+using namespace zeroconf;
+
+//------------------------------------------------------------------------------
+
+namespace {
+
+void testLeastRecentlyUsed()
+{
+    MonitorList monitors(2);
+    CHECK(monitors.enabled());
+
+    std::string demoted;
+    CHECK(!monitors.touch("a", demoted));
+    CHECK(!monitors.touch("b", demoted));
+
+    // Touching a again makes b the one used longest ago
+    CHECK(!monitors.touch("a", demoted));
+    CHECK(monitors.size() == 2);
+
+    CHECK(monitors.touch("c", demoted));
+    CHECK(demoted == "b");
+    CHECK(!monitors.contains("b"));
+    CHECK(monitors.contains("a"));
+    CHECK(monitors.contains("c"));
+
+    CHECK(monitors.touch("b", demoted));
+    CHECK(demoted == "a");
+}
+
+void testErase()
+{
+    MonitorList monitors(2);
+    std::string demoted;
+
+    monitors.touch("a", demoted);
+    monitors.touch("b", demoted);
+
+    CHECK(monitors.erase("a"));
+    CHECK(!monitors.erase("a"));
+
+    // Room again after erase
+    CHECK(!monitors.touch("c", demoted));
+    CHECK(monitors.size() == 2);
+
+    monitors.clear();
+    CHECK(monitors.size() == 0);
+    CHECK(!monitors.contains("b"));
+}
+
+void testDisabled()
+{
+    MonitorList monitors(0);
+    CHECK(!monitors.enabled());
+
+    // Without capacity a touched service is demoted right away
+    std::string demoted;
+    CHECK(monitors.touch("a", demoted));
+    CHECK(demoted == "a");
+    CHECK(monitors.size() == 0);
+}
+
+}
+
+//------------------------------------------------------------------------------
+
+int main()
+{
+    testLeastRecentlyUsed();
+    testErase();
+    testDisabled();
+
+    return test::result();
+}
@@ -0,0 +1,76 @@
+#include "Bench.h"
+
+#include <Zeroconf/ResolveBacklog.h>
+
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace zeroconf;
+
+//------------------------------------------------------------------------------
+
+namespace {
+
+Service service(size_t i)
+{
+    Service s;
+    s.name      = "Service " + std::to_string(i);
+    s.type      = "_http._tcp";
+    s.domain    = "local";
+    s.interface = 1;
+    return s;
+}
+
+// Every service queued at once, a third of them goes away before its turn,
+// the rest is taken out one by one as slots free up
+void backlog(size_t services)
+{
+    ResolveBacklog queue;
+
+    auto s = bench::seconds([&] {
+        for (size_t i = 0; i < services; ++i) queue.push(std::to_string(i), service(i));
+        for (size_t i = 0; i < services; i += 3) queue.erase(std::to_string(i));
+        while (!queue.empty()) queue.pop();
+    });
+
+    auto label = "ResolveBacklog, " + std::to_string(services) + " services";
+    bench::report(label.c_str(), services, s);
+}
+
+// The work list the Bonjour browser had before, erase(begin()) per resolve
+void workList(size_t services)
+{
+    std::vector<std::pair<std::string, Service>> work;
+
+    auto s = bench::seconds([&] {
+        for (size_t i = 0; i < services; ++i) work.emplace_back(std::to_string(i), service(i));
+        for (size_t i = 0; i < services; i += 3)
+        {
+            auto key = std::to_string(i);
+            auto it  = std::find_if(work.begin(), work.end(), [&] (const auto& w) { return w.first == key; });
+            if (it != work.end()) work.erase(it);
+        }
+        while (!work.empty()) work.erase(work.begin());
+    });
+
+    auto label = "vector erase(begin()), " + std::to_string(services) + " services";
+    bench::report(label.c_str(), services, s);
+}
+
+}
+
+//------------------------------------------------------------------------------
+
+int main()
+{
+    std::printf("Backlog of resolves: queue all, drop a third, take the rest\n");
+    for (size_t services : {2000, 10000})
+    {
+        backlog(services);
+        workList(services);
+    }
+
+    return 0;
+}
@@ -0,0 +1,93 @@
+#include "Check.h"
+
+#include <Zeroconf/ResolveBacklog.h>
+
+#include <climits>
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace zeroconf;
+
+//------------------------------------------------------------------------------
+
+namespace {
+
+Service service(const std::string& name)
+{
+    Service s = {};
+    s.name = name;
+    return s;
+}
+
+std::vector<std::string> drain(ResolveBacklog& backlog)
+{
+    std::vector<std::string> keys;
+    while (!backlog.empty())
+    {
+        auto next = backlog.pop();
+        CHECK(next.second.name == next.first);
+        keys.push_back(next.first);
+    }
+    return keys;
+}
+
+void testFirstComeFirstServed()
+{
+    ResolveBacklog backlog;
+
+    for (auto name : {"a", "b", "c"}) CHECK(backlog.push(name, service(name)));
+
+    // Each identity is queued once
+    CHECK(!backlog.push("b", service("b")));
+    CHECK(backlog.size() == 3);
+    CHECK(backlog.contains("b"));
+
+    CHECK((drain(backlog) == std::vector<std::string>{"a", "b", "c"}));
+    CHECK(!backlog.contains("b"));
+}
+
+void testPriority()
+{
+    // The extremes too, the order must not overflow
+    std::map<std::string, int> priorities = {{"min", INT_MIN}, {"low", -1}, {"zero", 0}, {"high", 1}, {"max", INT_MAX}};
+    ResolveBacklog backlog([&] (const Service& s) { return priorities[s.name]; });
+
+    for (auto name : {"zero", "min", "high", "max", "low"}) backlog.push(name, service(name));
+    backlog.push("zero2", service("zero2"));
+
+    CHECK((drain(backlog) == std::vector<std::string>{"max", "high", "zero", "zero2", "low", "min"}));
+}
+
+void testErase()
+{
+    ResolveBacklog backlog;
+
+    for (auto name : {"a", "b", "c"}) backlog.push(name, service(name));
+
+    CHECK(backlog.erase("b"));
+    CHECK(!backlog.erase("b"));
+    CHECK(!backlog.contains("b"));
+
+    // Queued again, it goes to the back
+    CHECK(backlog.push("b", service("b")));
+    CHECK((drain(backlog) == std::vector<std::string>{"a", "c", "b"}));
+
+    backlog.push("a", service("a"));
+    backlog.clear();
+    CHECK(backlog.empty());
+    CHECK(!backlog.contains("a"));
+}
+
+}
+
+//------------------------------------------------------------------------------
+
+int main()
+{
+    testFirstComeFirstServed();
+    testPriority();
+    testErase();
+
+    return test::result();
+}
@@ -0,0 +1,62 @@
+#include "Bench.h"
+
+#include <Zeroconf/Service.h>
+#include <Zeroconf/Signal.h>
+
+#ifdef BENCH_BOOST
+#include <boost/signals2.hpp>
+#endif
+
+#include <memory>
+#include <string>
+
+using namespace zeroconf;
+
+//------------------------------------------------------------------------------
+
+namespace {
+
+const size_t EMITS = 1000000;
+
+using ServicePtr = std::shared_ptr<Service>;
+
+// Emits a service like serviceAdded does, every slot touches it
+template <typename Signal>
+void emit(const char* name, Signal& signal, size_t slots)
+{
+    size_t calls = 0;
+    for (size_t i = 0; i < slots; ++i)
+        signal.connect([&calls] (ServicePtr s) { calls += s->port; });
+
+    auto service  = std::make_shared<Service>();
+    service->port = 1;
+
+    auto s = bench::seconds([&] {
+        for (size_t i = 0; i < EMITS; ++i) signal(service);
+    });
+
+    auto label = std::string(name) + ", " + std::to_string(slots) + " slot(s)";
+    bench::report(label.c_str(), EMITS, s);
+    if (calls != EMITS * slots) std::printf("%-40s %10zu calls missing\n", "", EMITS * slots - calls);
+}
+
+}
+
+//------------------------------------------------------------------------------
+
+int main()
+{
+    std::printf("%zu emits of a ServicePtr\n", EMITS);
+    for (size_t slots : {1, 4, 16})
+    {
+        Signal<ServicePtr> signal;
+        emit("Signal", signal, slots);
+
+#ifdef BENCH_BOOST
+        boost::signals2::signal<void(ServicePtr)> boostSignal;
+        emit("boost::signals2", boostSignal, slots);
+#endif
+    }
+
+    return 0;
+}
@@ -0,0 +1,162 @@
+#include "Check.h"
+
+#include <Zeroconf/Signal.h>
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+using namespace zeroconf;
+
+//------------------------------------------------------------------------------
+
+namespace {
+
+void testConnect()
+{
+    Signal<int> signal;
+    CHECK(signal.empty());
+
+    std::vector<int> seen;
+    auto c = signal.connect([&] (int i) { seen.push_back(i); });
+    CHECK(c.connected());
+    CHECK(!signal.empty());
+
+    signal(1);
+    signal(2);
+    CHECK((seen == std::vector<int>{1, 2}));
+
+    c.disconnect();
+    CHECK(!c.connected());
+    CHECK(signal.empty());
+
+    signal(3);
+    CHECK(seen.size() == 2);
+
+    // Twice does no harm
+    c.disconnect();
+}
+
+void testScopedConnection()
+{
+    Signal<> signal;
+    int calls = 0;
+
+    {
+        ScopedConnection c = signal.connect([&] { ++calls; });
+        signal();
+
+        // Moved, the connection stays
+        ScopedConnection moved = std::move(c);
+        CHECK(!c.connected());
+        CHECK(moved.connected());
+        signal();
+    }
+
+    signal();
+    CHECK(calls == 2);
+    CHECK(signal.empty());
+}
+
+void testOutliveSignal()
+{
+    Connection c;
+    {
+        Signal<> signal;
+        c = signal.connect([] {});
+    }
+
+    CHECK(!c.connected());
+    c.disconnect();
+
+    // A scoped connection destroyed after its signal does no harm either
+    auto signal = std::make_unique<Signal<>>();
+    ScopedConnection scoped = signal->connect([] {});
+    signal.reset();
+}
+
+//------------------------------------------------------------------------------
+
+void testDisconnectDuringEmit()
+{
+    Signal<> signal;
+    std::vector<int> seen;
+
+    // The first slot disconnects itself and the third, the third isn't called
+    // by the emit still walking the old list
+    Connection first, third;
+    first = signal.connect([&] { seen.push_back(1); first.disconnect(); third.disconnect(); });
+    signal.connect([&] { seen.push_back(2); });
+    third = signal.connect([&] { seen.push_back(3); });
+
+    signal();
+    CHECK((seen == std::vector<int>{1, 2}));
+
+    seen.clear();
+    signal();
+    CHECK((seen == std::vector<int>{2}));
+}
+
+void testConnectDuringEmit()
+{
+    Signal<> signal;
+    int calls = 0, added = 0;
+
+    // Slots connected while emitting are called from the next emit on
+    signal.connect([&] {
+        ++calls;
+        if (calls == 1) signal.connect([&] { ++added; });
+    });
+
+    signal();
+    CHECK(added == 0);
+
+    signal();
+    CHECK(added == 1);
+}
+
+void testConcurrentDisconnect()
+{
+    Signal<int> signal;
+    std::atomic<bool> stop = {false};
+    std::atomic<long> calls = {0};
+
+    // Emits without locking while the slot list is swapped under it
+    std::thread emitter([&] {
+        while (!stop.load())
+            signal(1);
+    });
+
+    for (int i = 0; i < 2000; ++i)
+    {
+        auto c = signal.connect([&] (int v) { calls.fetch_add(v); });
+        ScopedConnection scoped = signal.connect([] (int) {});
+        c.disconnect();
+    }
+
+    stop.store(true);
+    emitter.join();
+    CHECK(signal.empty());
+
+    // Nothing is left connected
+    auto before = calls.load();
+    signal(1);
+    CHECK(calls.load() == before);
+}
+
+}
+
+//------------------------------------------------------------------------------
+
+int main()
+{
+    testConnect();
+    testScopedConnection();
+    testOutliveSignal();
+    testDisconnectDuringEmit();
+    testConnectDuringEmit();
+    testConcurrentDisconnect();
+
+    return test::result();
+}
@@ -0,0 +1,313 @@
+#include "StandIn.h"
+
+#include <Zeroconf/EventQueue.h>
+
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <set>
+#include <vector>
+
+using namespace standin;
+
+//------------------------------------------------------------------------------
+
+namespace {
+
+// What Daemon sees of a Browser::Impl, which can't be named here
+class Sink
+{
+public:
+    virtual ~Sink() = default;
+
+    virtual bool browses(const std::string& type) const = 0;
+    virtual void reply(const Reply& r) = 0;
+    virtual void hold()    = 0;
+    virtual void publish() = 0;
+};
+
+// The started browsers, the lock is held while a reply is delivered
+std::mutex         sinksMutex;
+std::vector<Sink*> sinks;
+
+void attach(Sink* s)
+{
+    std::lock_guard<std::mutex> lock(sinksMutex);
+    if (std::find(sinks.begin(), sinks.end(), s) == sinks.end()) sinks.push_back(s);
+}
+
+void detach(Sink* s)
+{
+    std::lock_guard<std::mutex> lock(sinksMutex);
+    sinks.erase(std::remove(sinks.begin(), sinks.end(), s), sinks.end());
+}
+
+}
+
+//------------------------------------------------------------------------------
+
+void Daemon::send(const Reply& reply)
+{
+    std::lock_guard<std::mutex> lock(sinksMutex);
+    for (auto* s : sinks)
+        if (s->browses(reply.type)) s->reply(reply);
+}
+
+void Daemon::hold()
+{
+    std::lock_guard<std::mutex> lock(sinksMutex);
+    for (auto* s : sinks) s->hold();
+}
+
+void Daemon::publish()
+{
+    std::lock_guard<std::mutex> lock(sinksMutex);
+    for (auto* s : sinks) s->publish();
+}
+
+//------------------------------------------------------------------------------
+
+namespace zeroconf {
+
+class Browser::Impl : public Sink
+{
+public:
+
+    Impl(Browser* parent, const Options& options)
+    : _parent(parent)
+    , _dispatch(options.dispatch)
+    , _queue(options.queueCapacity, options.backpressure, [] (const Event& e) { return e.name.str(); })
+    {
+    }
+
+    ~Impl() override
+    {
+        detach(this);
+    }
+
+    // Follows Browser_avahiclient.cpp, the backend lock is _mutex here
+    void poll(Batch* batch = nullptr)
+    {
+        std::lock_guard<std::recursive_mutex> polling(_pollMutex);
+        auto events = std::vector<Event>();
+        events.swap(_taken);
+        _queue.take(events);
+
+        {
+            std::lock_guard<std::recursive_mutex> guard(_mutex);
+            _parent->_batch = batch;
+            _parent->holdSignals(true);
+
+            for (const auto& e : events) process(e);
+            _queue.taken();
+            events.clear();
+            _taken.swap(events);
+
+            _parent->flushUpdates();
+
+            auto dropped = _queue.dropped();
+            if (dropped != _lost) { _lost = dropped; _parent->notifyError(ZC_BROWSER_EVENTS_LOST); }
+
+            _parent->_batch = nullptr;
+            _parent->holdSignals(false);
+        }
+        _parent->emitHeld();
+    }
+
+    void poll(std::chrono::milliseconds timeout)
+    {
+        _queue.wait(timeout);
+        poll();
+    }
+
+    std::vector<ServicePtr> services() const
+    {
+        std::lock_guard<std::recursive_mutex> lock(_mutex);
+
+        auto result = std::vector<ServicePtr>();
+        for (const auto& s : _services) result.push_back(s.second);
+        return result;
+    }
+
+    Statistics statistics() const
+    {
+        auto s = Statistics();
+        s.queued    = _queue.size();
+        s.dropped   = _queue.dropped();
+        s.coalesced = _queue.coalesced();
+        s.highWater = _queue.highWater();
+        return s;
+    }
+
+    int nativeHandle() const { return _queue.nativeHandle(); }
+
+    Connection subscribe(const ChangeHandler& handler)
+    {
+        std::lock_guard<std::recursive_mutex> lock(_mutex);
+
+        for (const auto& s : _services)
+            handler(ADDED, s.second);
+        return _parent->_changed.connect(handler);
+    }
+
+    // Replies come resolved
+    std::shared_future<ServicePtr> request(ServicePtr s)
+    {
+        std::lock_guard<std::recursive_mutex> lock(_mutex);
+        auto it = _services.find(s->name);
+        return lookupReady(it != _services.end() && it->second == s ? s : nullptr);
+    }
+
+    void start(const std::string& type, Protocol)
+    {
+        addType(type);
+    }
+
+    void stop()
+    {
+        detach(this);
+
+        std::lock_guard<std::recursive_mutex> lock(_mutex);
+        _types.clear();
+        _services.clear();
+        _parent->notifyCleared();
+    }
+
+    void addType(const std::string& type)
+    {
+        {
+            std::lock_guard<std::recursive_mutex> lock(_mutex);
+            _types.insert(type);
+        }
+        attach(this);
+    }
+
+    void removeType(const std::string& type)
+    {
+        std::lock_guard<std::recursive_mutex> lock(_mutex);
+        _types.erase(type);
+    }
+
+    std::vector<std::string> types() const
+    {
+        std::lock_guard<std::recursive_mutex> lock(_mutex);
+        return std::vector<std::string>(_types.begin(), _types.end());
+    }
+
+    // --- Sink, on the daemon thread
+
+    bool browses(const std::string& type) const override
+    {
+        std::lock_guard<std::recursive_mutex> lock(_mutex);
+        return _types.count(type) != 0;
+    }
+
+    void reply(const Reply& r) override
+    {
+        auto build = [&] (Event& e, Queue::Arena& a) {
+            e.kind    = r.kind;
+            e.port    = r.port;
+            e.name    = a.copy(r.name);
+            e.type    = a.copy(r.type);
+            e.host    = a.copy(r.host);
+            e.address = a.copy(r.address);
+        };
+
+        if (_dispatch == DISPATCH_QUEUED)
+        {
+            _queue.emplace(r.name.size() + r.type.size() + r.host.size() + r.address.size(), build);
+            return;
+        }
+
+        Event e;
+        Queue::Arena borrow;
+        build(e, borrow);
+
+        std::lock_guard<std::recursive_mutex> lock(_mutex);
+        process(e);
+        _queue.wake();
+    }
+
+    void hold()    override { _queue.hold();    }
+    void publish() override { _queue.publish(); }
+
+private:
+
+    struct Event
+    {
+        Reply::Kind kind = Reply::FOUND;
+        uint16_t    port = 0;
+        Text        name;
+        Text        type;
+        Text        host;
+        Text        address;
+    };
+
+    using Queue = EventQueue<Event>;
+
+    void process(const Event& e)
+    {
+        auto name = e.name.str();
+        auto it   = _services.find(name);
+
+        if (e.kind == Reply::GONE)
+        {
+            if (it == _services.end()) return;
+
+            auto s = it->second;
+            _services.erase(it);
+            _parent->notifyRemoved(s);
+            return;
+        }
+
+        auto isNew = it == _services.end();
+        auto s     = isNew ? std::make_shared<Service>() : it->second;
+        s->name      = name;
+        s->type      = e.type.str();
+        s->domain    = "local";
+        s->host      = e.host.str();
+        s->interface = 1;
+        s->port      = e.port;
+        setAddresses(*s, PROTOCOL_IPv4, {e.address.str()});
+
+        if (isNew) { _services[name] = s; _parent->notifyAdded(s); }
+        else       { _parent->notifyUpdated(s);                    }
+    }
+
+    Browser*                         _parent;
+    Dispatch                         _dispatch;
+    Queue                            _queue;
+    std::vector<Event>               _taken;
+    size_t                           _lost = 0;
+    std::set<std::string>            _types;
+    std::map<std::string, ServicePtr> _services;
+
+    mutable std::recursive_mutex     _mutex;
+    std::recursive_mutex             _pollMutex;
+};
+
+//---------------------------------------------------------------------
+//--- Browser
+//---------------------------------------------------------------------
+
+Browser::Browser()                              : Browser(Options()) {}
+Browser::Browser(const Options& options)        { init(options); _impl = std::make_unique<Impl>(this, options); }
+Browser::~Browser() = default;
+
+//---------------------------------------------------------------------
+
+void Browser::poll()                                             { _impl->poll(); }
+void Browser::pollBatch(Batch& batch)                            { _impl->poll(&batch); }
+void Browser::poll(std::chrono::milliseconds timeout)            { _impl->poll(flushTimeout(timeout)); }
+std::vector<ServicePtr> Browser::services() const                { return _impl->services(); }
+Browser::Statistics Browser::queueStatistics() const             { return _impl->statistics(); }
+int Browser::nativeHandle() const                                { return _impl->nativeHandle(); }
+Connection Browser::subscribe(const ChangeHandler& h)            { return _impl->subscribe(h); }
+std::shared_future<ServicePtr> Browser::resolve(ServicePtr s)    { return _impl->request(s); }
+void Browser::start(const std::string& type, Protocol protocol)  { _impl->start(type, protocol); }
+void Browser::stop()                                             { _impl->stop(); }
+void Browser::addType(const std::string& type)                   { _impl->addType(type); }
+void Browser::removeType(const std::string& type)                { _impl->removeType(type); }
+std::vector<std::string> Browser::types() const                  { return _impl->types(); }
+
+}
@@ -0,0 +1,55 @@
+// Copyright (c) 2017  Mathias Roder (teuse@mailbox.org)
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+#include <Zeroconf/Browser.h>
+
+#include <cstdint>
+#include <string>
+
+
+// Scripted stand-in for the daemon, for the benchmarks. StandIn.cpp defines
+// Browser::Impl in place of Browser_avahiclient.cpp or Browser_bonjour.cpp,
+// linked with Browser.cpp and Subscriber.cpp it runs Browsers without Avahi or
+// Bonjour. The thread calling Daemon plays the daemon thread: the started
+// Browsers of a type get its replies, queued for poll() or processed right
+// away with DISPATCH_DIRECT, like the backends do.
+
+namespace standin {
+
+struct Reply
+{
+    enum Kind { FOUND, GONE };
+
+    Kind        kind = FOUND;       // FOUND adds the service or updates it
+    std::string name;
+    std::string type;
+    std::string host;
+    std::string address;
+    uint16_t    port = 0;
+};
+
+class Daemon
+{
+public:
+
+    static void send(const Reply& reply);
+
+    // Replies sent between hold() and publish() reach the queues at once, like
+    // those Bonjour flags with MoreComing
+    static void hold();
+    static void publish();
+};
+
+}
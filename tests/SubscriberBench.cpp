@@ -0,0 +1,76 @@
+#include "Bench.h"
+#include "StandIn.h"
+
+#include <Zeroconf/Subscriber.h>
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace zeroconf;
+
+//------------------------------------------------------------------------------
+
+namespace {
+
+const size_t SERVICES = 20000;
+
+const char* TYPE = "_http._tcp";
+
+// One browse polled on the main thread, fanned out to worker threads which
+// each poll their own subscriber. Measured until every worker has seen every
+// service.
+void fanOut(size_t workers)
+{
+    Browser browser;
+    browser.start(TYPE);
+
+    std::vector<std::unique_ptr<Subscriber>> subscribers;
+    std::vector<std::unique_ptr<std::atomic<size_t>>> seen;
+    for (size_t i = 0; i < workers; ++i)
+    {
+        subscribers.push_back(std::make_unique<Subscriber>(browser));
+        seen.push_back(std::make_unique<std::atomic<size_t>>(0));
+        auto* counter = seen.back().get();
+        subscribers.back()->connectServiceAdded([counter] (ServicePtr) { ++*counter; });
+    }
+
+    auto s = bench::seconds([&] {
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < workers; ++i)
+        {
+            threads.emplace_back([&, i] {
+                while (seen[i]->load() < SERVICES)
+                    subscribers[i]->poll(std::chrono::milliseconds(10));
+            });
+        }
+
+        std::thread daemon([&] {
+            for (size_t i = 0; i < SERVICES; ++i)
+                standin::Daemon::send({standin::Reply::FOUND, "Service " + std::to_string(i), TYPE, "host.local", "10.0.0.1", 80});
+        });
+
+        while (browser.services().size() < SERVICES)
+            browser.poll(std::chrono::milliseconds(10));
+        daemon.join();
+        for (auto& t : threads) t.join();
+    });
+
+    auto label = std::to_string(workers) + " subscriber(s)";
+    bench::report(label.c_str(), SERVICES, s);
+}
+
+}
+
+//------------------------------------------------------------------------------
+
+int main()
+{
+    std::printf("%zu services fanned out to worker threads\n", SERVICES);
+    for (size_t workers : {1, 4, 8})
+        fanOut(workers);
+
+    return 0;
+}
@@ -0,0 +1,149 @@
+#include "Check.h"
+
+#include <Zeroconf/TxtRecord.h>
+
+#include <initializer_list>
+#include <string>
+#include <string_view>
+
+using namespace zeroconf;
+
+//------------------------------------------------------------------------------
+
+namespace {
+
+// Wire format: a length byte before each string
+std::string wire(std::initializer_list<std::string_view> entries)
+{
+    std::string data;
+    for (auto e : entries)
+    {
+        data += char(e.size());
+        data.append(e.data(), e.size());
+    }
+    return data;
+}
+
+void testLookup()
+{
+    TxtRecord txt(wire({"path=/index.html", "Version=2", "flag", "empty=", "eq=a=b", "version=3"}));
+
+    CHECK(txt.size() == 6);
+    CHECK(txt.key(0) == "path");
+    CHECK(txt.value(0) == "/index.html");
+
+    // Case insensitive, the first of equal keys wins
+    CHECK(txt.value("VERSION") == "2");
+    CHECK(txt.key(5) == "version");
+    CHECK(txt.value(5) == "3");
+
+    // Boolean attributes and empty values are both there without a value
+    CHECK(txt.contains("flag"));
+    CHECK(txt.find("flag")->empty());
+    CHECK(txt.key(2) == "flag");
+    CHECK(txt.contains("empty"));
+    CHECK(txt.find("empty")->empty());
+
+    // Only the first "=" separates
+    CHECK(txt.value("eq") == "a=b");
+
+    CHECK(!txt.contains("missing"));
+    CHECK(!txt.find("pat"));
+    CHECK(txt.value("missing", "fallback") == "fallback");
+}
+
+void testEmpty()
+{
+    TxtRecord none;
+    CHECK(none.empty());
+    CHECK(none.data().empty());
+
+    CHECK(TxtRecord(std::string_view()).empty());
+
+    // A single empty string, what a service without attributes sends
+    TxtRecord zero(std::string(1, '\0'));
+    CHECK(zero.empty());
+    CHECK(!zero.contains(""));
+
+    // Empty strings between entries are skipped
+    TxtRecord gaps(std::string(2, '\0') + wire({"a=1"}) + std::string(1, '\0') + wire({"b=2"}));
+    CHECK(gaps.size() == 2);
+    CHECK(gaps.value("a") == "1");
+    CHECK(gaps.value("b") == "2");
+}
+
+//------------------------------------------------------------------------------
+
+void testTruncated()
+{
+    auto good = wire({"a=1", "b=2"});
+
+    // The last length byte claims more than there is
+    TxtRecord cut(good + "\x09" "c=3");
+    CHECK(cut.size() == 2);
+    CHECK(cut.value("b") == "2");
+    CHECK(!cut.contains("c"));
+    CHECK(cut.data() == good);
+    CHECK(cut == TxtRecord(good));
+
+    // A lone length byte at the end
+    TxtRecord lone(good + "\x05");
+    CHECK(lone.size() == 2);
+    CHECK(lone.data() == good);
+
+    // Nothing but a length byte
+    TxtRecord only("\x7f");
+    CHECK(only.empty());
+    CHECK(only.data().empty());
+
+    // Cut in the middle of the first entry
+    auto first = wire({"key=value"});
+    TxtRecord partial(std::string_view(first.data(), 4));
+    CHECK(partial.empty());
+    CHECK(partial.data().empty());
+}
+
+void testMalformed()
+{
+    // Binary values, including zero bytes, are taken as they are
+    std::string binary("k=\0\xff\x01", 5);
+    TxtRecord txt(wire({binary, "=novalue", "x"}));
+    CHECK(txt.size() == 3);
+    CHECK(txt.value("k") == std::string_view("\0\xff\x01", 3));
+
+    // An entry without a key is indexed but matches an empty key only
+    CHECK(txt.key(1).empty());
+    CHECK(txt.value(1) == "novalue");
+    CHECK(txt.value("x").empty());
+}
+
+void testTooLong()
+{
+    // A TXT record is at most 65535 bytes, entries ending beyond are left out
+    std::string entry(255, 'v');
+    entry[0] = 'k';
+    entry[1] = '=';
+
+    std::string data;
+    for (int i = 0; i < 300; ++i) data += wire({entry});
+
+    TxtRecord txt(data);
+    CHECK(txt.size() == 255);
+    CHECK(txt.data().size() == 255 * 256);
+    CHECK(txt.value(254).size() == 253);
+}
+
+}
+
+//------------------------------------------------------------------------------
+
+int main()
+{
+    testLookup();
+    testEmpty();
+    testTruncated();
+    testMalformed();
+    testTooLong();
+
+    return test::result();
+}
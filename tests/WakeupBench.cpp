@@ -0,0 +1,74 @@
+#include "Bench.h"
+#include "StandIn.h"
+
+#include <atomic>
+#include <string>
+#include <thread>
+
+using namespace zeroconf;
+
+//------------------------------------------------------------------------------
+
+namespace {
+
+const size_t RECORDS = 1000;
+const size_t BURSTS  = 20;
+
+const char* TYPE = "_http._tcp";
+
+// The daemon replays bursts of records, reading each takes it a moment. With
+// held replies the burst reaches the queue like the replies Bonjour flags with
+// MoreComing, at once. Counts how often the polling thread wakes up to handle
+// a part of a burst.
+void bursts(const char* name, bool held)
+{
+    Browser browser;
+    browser.start(TYPE);
+
+    std::atomic<size_t> seen = {0};
+    browser.connectServiceAdded([&] (ServicePtr) { ++seen; });
+    browser.connectServiceRemoved([&] (ServicePtr) { ++seen; });
+
+    size_t wakeups = 0;
+    auto s = bench::seconds([&] {
+        std::thread daemon([&] {
+            for (size_t b = 0; b < BURSTS; ++b)
+            {
+                if (held) standin::Daemon::hold();
+                for (size_t i = 0; i < RECORDS; ++i)
+                {
+                    auto until = bench::Clock::now() + std::chrono::microseconds(1);
+                    while (bench::Clock::now() < until) {}
+
+                    auto kind = b % 2 ? standin::Reply::GONE : standin::Reply::FOUND;
+                    standin::Daemon::send({kind, "Service " + std::to_string(i), TYPE, "host.local", "10.0.0.1", 80});
+                }
+                if (held) standin::Daemon::publish();
+            }
+        });
+
+        while (seen.load() < RECORDS * BURSTS)
+        {
+            auto before = seen.load();
+            browser.poll(std::chrono::milliseconds(100));
+            if (seen.load() != before) ++wakeups;
+        }
+        daemon.join();
+    });
+
+    bench::report(name, RECORDS * BURSTS, s);
+    std::printf("%-40s %10.1f wakeups per burst of %zu\n", "", double(wakeups) / BURSTS, RECORDS);
+}
+
+}
+
+//------------------------------------------------------------------------------
+
+int main()
+{
+    std::printf("%zu bursts of %zu records\n", BURSTS, RECORDS);
+    bursts("queued per reply", false);
+    bursts("held until the burst is complete", true);
+
+    return 0;
+}